@@ -26,21 +26,775 @@
 #include <fstream>
 #include <string.h>
 #include <sstream>
+#include <omp.h>
 
 #include "utilities.h"
-#include "Matrix.hpp"
-#include "Bicluster.hpp"
-#include "Driver.hpp"
+#include "Engine.hpp"
+#include "Server.hpp"
+#include "Memory.hpp"
+#include "Trace.hpp"
 
 using namespace std;
 using namespace boost::program_options;
 
-typedef vector<Bicluster> Biclustervect;
+
+/**
+	\brief Return the number of biclusters in a that are not included in b
+	
+	\param a the first result set
+	\param b the second result set
+	\return the number of biclusters of a missing in b
+*/
+
+static unsigned int count_missing(Biclustervect& a, Biclustervect& b)
+{
+	unsigned int n = 0;
+	for(unsigned int i=0; i<a.size(); i++)
+		if (!a[i].include(b)) n++;
+	return n;
+}
+
+
+/**
+	\brief Return the labels saved in filename, or mock labels if the file does not list n labels
+	
+	\param filename filepath, empty if no labels are provided
+	\param n number of labels
+	\param prefix prefix of mock labels
+	\param dimension name of the dimension (for messages)
+	\return the labels
+*/
+
+static stringvect load_labels(const string& filename, unsigned int n, const string& prefix, const string& dimension)
+{
+	//if not present mock symbols are used 
+	if (filename.empty()) return get_mock_elements(prefix, n);
+	
+	cout << "Loading labels (" << dimension << ")..." << endl;	
+	stringvect list = loadListFromFile(const_cast<char *>(filename.c_str()));
+	if (list.size() != n) 
+	{
+		cout << "WARNING: I cannot open the file '" << filename << "' or there are some problem with the " << dimension << " list size" << endl;
+		cout << "\t I will return the numeric signature" << endl;
+		list = get_mock_elements(prefix, n);
+	}
+	cout << "\t done." << endl;
+	return list;
+}
+
+
+/**
+	\brief Save the biclusters, mapping their indices to labels
+	
+	If the biclusters were scored, the scores follow the size of each bicluster on its first line.
+	
+	\param filename filepath
+	\param results the biclusters
+	\param geneList gene labels
+	\param conditionList condition labels
+	\param scores the scores of each bicluster, empty if they were not scored (p-values and stabilities only if resampled)
+*/
+
+static void write_results(const string& filename, Biclustervect& results, stringvect& geneList, stringvect& conditionList, Qualityvect& scores)
+{
+	ostringstream output_str;
+	for(unsigned int i=0; i<results.size(); i++)
+	{
+		//bicluster size [row, col]
+		output_str << "[" << results[i].getGeneCluster().size() << ", " << results[i].getConditionCluster().size() << "]";
+		if (!scores.empty())
+			output_str << "\tresidue " << scores[i].residue << "\tcorrelation " << scores[i].correlation << "\tcoherence " << scores[i].coherence
+			           << "\tgene_distance " << scores[i].gene_distance << "\tcondition_distance " << scores[i].condition_distance;
+		if (!scores.empty() && scores[i].p_value >= 0) output_str << "\tp_value " << scores[i].p_value;
+		if (!scores.empty() && scores[i].stability >= 0) output_str << "\tstability " << scores[i].stability;
+		output_str << endl;
+		//map the signature (that are index!) in the name of genes/experiments	
+		output_str << results[i].to_humanString(geneList, conditionList) << endl;
+	}
+	printToFile(filename.c_str(), output_str.str());
+}
+
+
+/**
+	\brief Save the biclusters found by a shard, with the grid cell where they were found.
+	
+	The header line reports data size, shard and run parameters (\see Engine::partialHeader); then each bicluster 
+	takes three lines: "@ cell", gene indices and condition indices.
+	
+	\param filename filepath
+	\param results the biclusters
+	\param found_at the grid cell where each bicluster was found
+	\param header the header line
+*/
+
+static void write_partial(const string& filename, Biclustervect& results, cellvect& found_at, const string& header)
+{
+	ostringstream output_str;
+	output_str << header << endl;
+	for(unsigned int i=0; i<results.size(); i++)
+	{
+		intvect genes = results[i].getGeneCluster().getElements();
+		intvect conditions = results[i].getConditionCluster().getElements();
+		output_str << "@ " << found_at[i] << endl;
+		for(unsigned int j=0; j<genes.size(); j++) output_str << genes[j] << "\t";
+		output_str << endl;
+		for(unsigned int j=0; j<conditions.size(); j++) output_str << conditions[j] << "\t";
+		output_str << endl;
+	}
+	printToFile(filename.c_str(), output_str.str());
+}
+
+
+/**
+	\brief Map the genes of biclusters found on filtered data to the loaded genes (\see Engine::filterGenes)
+	
+	\param results the biclusters
+	\param kept_genes the loaded index of each gene, empty if genes were not filtered
+	\param num_genes number of loaded genes
+*/
+
+static void unfilter_genes(Biclustervect& results, const intvect& kept_genes, unsigned int num_genes)
+{
+	if (kept_genes.empty()) return;
+	for(unsigned int i=0; i<results.size(); i++)
+	{
+		Cluster genes(num_genes, 0.0);
+		for(unsigned int j=0; j<kept_genes.size(); j++)
+			genes.setValue(kept_genes[j], results[i].getGeneCluster().getValue(j));
+		results[i].setGeneCluster(genes);
+	}
+}
+
+
+/**
+	\brief Return a cluster of n objects where the objects listed in line are set to 1.0
+	
+	\param line the object indices
+	\param n number of objects
+	\param cluster the cluster
+	\return false if an index is out of range, true otherwise
+*/
+
+static bool read_cluster(const string& line, unsigned int n, Cluster& cluster)
+{
+	cluster = Cluster(n, 0.0);
+	istringstream is(line);
+	int index;
+	while (is >> index)
+	{
+		if (index < 0 || index >= (int) n) return false;
+		cluster.setValue(index, 1.0);
+	}
+	return true;
+}
+
+
+/**
+	\brief Load the biclusters saved by write_partial
+	
+	\param filename filepath
+	\param results the biclusters, to which loaded biclusters are appended
+	\param found_at the grid cell where each bicluster was found
+	\param num_genes number of genes, set by the first file read (i.e., if zero)
+	\param num_conditions number of conditions, set by the first file read (i.e., if zero)
+	\param shard the shard saved in the file
+	\param shards number of shards
+	\param run the run parameters, set by the first file read (i.e., if empty)
+	\return true on success, false if the file cannot be read or the data size or run parameters are not the expected ones
+*/
+
+static bool read_partial(const string& filename, Biclustervect& results, cellvect& found_at, unsigned int& num_genes, unsigned int& num_conditions, unsigned int& shard, unsigned int& shards, string& run)
+{
+	ifstream is(filename.c_str());
+	string line;
+	if (!getline(is, line)) return false;
+	
+	istringstream header(line);
+	string tag, kind;
+	unsigned int genes, conditions;
+	char slash;
+	if (!(header >> tag >> kind >> genes >> conditions >> shard >> slash >> shards) || tag != "#AID-ISA" || kind != "partial") return false;
+	if (num_genes == 0) num_genes = genes;
+	if (num_conditions == 0) num_conditions = conditions;
+	if (genes != num_genes || conditions != num_conditions) return false;
+	
+		//seed, runs, cells per run, deltas and drivers must be the same in all shards
+	string parameters;
+	if (!getline(header >> ws, parameters) || parameters.empty()) return false;
+	if (run.empty()) run = parameters;
+	if (parameters != run) return false;
+	
+	while (getline(is, line))
+	{
+		if (line.empty()) continue;
+		unsigned long cell;
+		if (sscanf(line.c_str(), "@ %lu", &cell) != 1) return false;
+		
+		string gene_line, condition_line;
+		Cluster g, c;
+		if (!getline(is, gene_line) || !getline(is, condition_line)) return false;
+		if (!read_cluster(gene_line, genes, g) || !read_cluster(condition_line, conditions, c)) return false;
+		
+		results.push_back(Bicluster(g, c));
+		found_at.push_back(cell);
+	}
+	return true;
+}
+
+
+/**
+	\brief Return a cluster of the objects whose labels are listed in line, separated by tabs
+	
+	\param line the object labels
+	\param index the index of each known label
+	\param n number of objects
+	\param cluster the cluster
+	\return the number of labels that are not known
+*/
+
+static unsigned int read_labelled_cluster(const string& line, map<string, int>& index, unsigned int n, Cluster& cluster)
+{
+	cluster = Cluster(n, 0.0);
+	istringstream is(line);
+	string label;
+	unsigned int unknown = 0;
+	while (getline(is, label, '\t'))
+	{
+		if (label.empty()) continue;
+		map<string, int>::iterator it = index.find(label);
+		if (it == index.end()) unknown++;
+		else cluster.setValue(it->second, 1.0);
+	}
+	return unknown;
+}
+
+
+/**
+	\brief Load a subset of the objects, listed by label one per line
+	
+	\param filename filepath
+	\param labels the labels of the data set
+	\param subset the indices of the objects, in the order they are listed
+	\param unknown number of labels that are not in the data set (or that are repeated)
+	\return false if the file cannot be read or it lists no known object, true otherwise
+*/
+
+static bool read_subset(const string& filename, stringvect& labels, intvect& subset, unsigned int& unknown)
+{
+	map<string, int> index;
+	for (unsigned int i=0; i<labels.size(); i++) index[labels[i]] = i;
+	
+	stringvect list = loadListFromFile(const_cast<char *>(filename.c_str()));
+	unknown = 0;
+	for (unsigned int i=0; i<list.size(); i++)
+	{
+		if (list[i].empty()) continue;
+		map<string, int>::iterator it = index.find(list[i]);
+		if (it == index.end())
+		{
+			unknown++;
+			continue;
+		}
+		subset.push_back(it->second);
+		index.erase(it);
+	}
+	return !subset.empty();
+}
+
+
+/**
+	\brief Load the biclusters saved by write_results, mapping their labels onto the data set.
+	
+	Labels that are not in the data set (e.g., those of removed genes) are skipped; biclusters left without 
+	genes are discarded.
+	
+	\param filename filepath
+	\param geneList gene labels of the data set
+	\param conditionList condition labels of the data set
+	\param results the biclusters, to which loaded biclusters are appended
+	\param unknown number of labels that are not in the data set
+	\return the number of biclusters read, -1 if the file cannot be read or it is not a results file
+*/
+
+static int read_results(const string& filename, stringvect& geneList, stringvect& conditionList, Biclustervect& results, unsigned int& unknown)
+{
+	ifstream is(filename.c_str());
+	if (!is) return -1;
+	
+	map<string, int> gene_index, condition_index;
+	for (unsigned int i=0; i<geneList.size(); i++) gene_index[geneList[i]] = i;
+	for (unsigned int i=0; i<conditionList.size(); i++) condition_index[conditionList[i]] = i;
+	
+	string line;
+	int read = 0;
+	unknown = 0;
+	while (getline(is, line))
+	{
+		if (line.empty()) continue;
+		if (line[0] != '[') return -1;
+		
+		string gene_line, condition_line;
+		Cluster g, c;
+		if (!getline(is, gene_line) || !getline(is, condition_line)) return -1;
+		unknown += read_labelled_cluster(gene_line, gene_index, geneList.size(), g);
+		unknown += read_labelled_cluster(condition_line, condition_index, conditionList.size(), c);
+		read++;
+		
+		if (g.size() > 0) results.push_back(Bicluster(g, c));
+	}
+	return read;
+}
+
+
+/**
+	\brief Merge near-duplicate biclusters (\see Engine::consolidate), reporting how many are left
+	
+	\param results the biclusters
+	\param found_at the grid cell where each bicluster was found
+	\param overlap the smallest overlap of merged biclusters
+*/
+
+static void consolidate_results(Biclustervect& results, cellvect& found_at, float overlap)
+{
+	cout << endl << "Consolidating biclusters overlapping by " << overlap << " or more..." << endl;
+	unsigned int merged = Engine::consolidate(results, found_at, overlap);
+	cout << "\t" << merged << " merged, " << results.size() << " left" << endl;
+}
+
+
+/**
+	\brief Save the events recorded so far as a Chrome trace (\see Trace), reporting how many they are
+	
+	\param filename filepath of the trace
+*/
+
+static void write_trace(const string& filename)
+{
+	cout << endl << "Saving trace..." << endl;
+	if (!Trace::write(filename)) cout << "WARNING: I cannot write the trace '" << filename << "'" << endl;
+	else cout << "\t" << Trace::to_string() << endl;
+}
+
+
+/**
+	\brief The merge subcommand: deduplicate the biclusters found by all the shards of a run.
+	
+	Biclusters are sorted by the grid cell where they were found, and kept the first time they
+	appear (equality is that of Bicluster::equal), so that the output is the one of the whole 
+	run on a single process.
+	
+	\param argc number of arguments (after "merge")
+	\param argv the arguments
+	\return exit status
+*/
+
+static int merge_main(int argc, char** argv)
+{
+	vector<string> partial_filenames;
+	string output_filename;
+	string gene_filename;
+	string condition_filename;
+	float overlap;
+	
+	options_description options("Merge options");
+	options.add_options()
+		("help,h", "produce help message and exit")
+		("partial", value< vector<string> >(&partial_filenames), "partial result filepaths")
+		("output,o", value<string>(&output_filename)->default_value("merged.out"), "AID-ISA output filepath")
+		("gene_labels,x", value<string>(&gene_filename),  "gene labels")
+		("condition_labels,y", value<string>(&condition_filename),  "condition labels")
+		("consolidate", value<float>(&overlap)->default_value(0.0), "merge biclusters sharing at least this fraction of their cells (0 to keep them all)");
+	
+	positional_options_description pos;
+	pos.add("partial", -1);
+	
+	try
+	{
+		variables_map vm;
+		store(command_line_parser(argc, argv).options(options).positional(pos).run(), vm);
+		notify(vm);
+		
+		if (vm.count("help") || partial_filenames.empty())
+		{
+			cout << "Usage: AID-ISA merge partial [partial ...] [options]" << endl << options << endl;
+			return vm.count("help") ? EX_OK : EX_USAGE;
+		}
+	}
+	catch (exception& e)
+	{
+		cerr << e.what() << endl;
+		return EX_USAGE;
+	}
+	
+	cout << endl << "###################   AID-ISA   ###################" << endl << endl;
+	
+	Biclustervect partial;
+	cellvect found_at;
+	unsigned int num_genes = 0;
+	unsigned int num_conditions = 0;
+	unsigned int shards = 0;
+	string run;
+	vector<bool> seen;
+	for(unsigned int i=0; i<partial_filenames.size(); i++)
+	{
+		cout << "Loading " << partial_filenames[i] << "..." << endl;
+		unsigned int shard, n;
+		if (!read_partial(partial_filenames[i], partial, found_at, num_genes, num_conditions, shard, n, run) || (shards != 0 && n != shards) || shard >= n)
+		{
+			cout << "ERROR: '" << partial_filenames[i] << "' is not a partial result of the same run" << endl;
+			return EX_DATAERR;
+		}
+		shards = n;
+		seen.resize(shards, false);
+		seen[shard] = true;
+	}
+	if (find(seen.begin(), seen.end(), false) != seen.end())
+		cout << "WARNING: some of the " << shards << " shards are missing" << endl;
+	
+	//the first time a bicluster is found is the same as in a single run
+	vector< pair<unsigned long, unsigned int> > order;
+	for(unsigned int i=0; i<partial.size(); i++)
+		order.push_back(make_pair(found_at[i], i));
+	sort(order.begin(), order.end());
+	
+	Biclustervect results;
+	cellvect merged_found_at;
+	for(unsigned int i=0; i<order.size(); i++)
+		Engine::collect(results, merged_found_at, partial[order[i].second], order[i].first);
+	cout << "\t" << partial.size() << " biclusters, " << results.size() << " distinct" << endl;
+	if (overlap > 0.0) consolidate_results(results, merged_found_at, overlap);
+	
+	stringvect geneList = load_labels(gene_filename, num_genes, "R", "gene");
+	stringvect conditionList = load_labels(condition_filename, num_conditions, "C", "condition");
+	
+	cout << endl << "Saving results..." << endl;
+	Qualityvect scores; //the matrix is not available to score the biclusters
+	write_results(output_filename, results, geneList, conditionList, scores);
+	cout << "\t done" << endl;
+	cout << endl << "###################################################" << endl << endl;
+	return EX_OK;
+}
+
+
+
+/**
+	\brief The serve subcommand: keep data sets loaded and run the jobs sent by local clients (\see Server).
+	
+	\param argc number of arguments (after "serve")
+	\param argv the arguments
+	\return exit status
+*/
+
+static int serve_main(int argc, char** argv)
+{
+	string socket_path;
+	unsigned int workers;
+	string trace_filename;
+	unsigned int trace_events;
+	
+	options_description options("Serve options");
+	options.add_options()
+		("help,h", "produce help message and exit")
+		("socket,S", value<string>(&socket_path)->default_value("aid-isa.sock"), "Unix domain socket filepath")
+		("workers,w", value<unsigned int>(&workers)->default_value(1), "number of jobs run at the same time")
+		("trace", value<string>(&trace_filename), "record a timeline of the jobs, and save it in this file as a Chrome trace on shutdown")
+		("trace_events", value<unsigned int>(&trace_events)->default_value(65536), "events kept by each thread while tracing (the oldest are overwritten)");
+	
+	try
+	{
+		variables_map vm;
+		store(command_line_parser(argc, argv).options(options).run(), vm);
+		notify(vm);
+		
+		if (vm.count("help"))
+		{
+			cout << "Usage: AID-ISA serve [options]" << endl << options << endl;
+			return EX_OK;
+		}
+	}
+	catch (exception& e)
+	{
+		cerr << e.what() << endl;
+		return EX_USAGE;
+	}
+	
+	cout << endl << "###################   AID-ISA   ###################" << endl << endl;
+	cout << "Serving on " << socket_path << " (" << workers << " workers)" << endl;
+	if (!trace_filename.empty()) Trace::enable(trace_events);
+	Server server(socket_path, workers);
+	if (!server.run())
+	{
+		cout << "ERROR: I cannot open the socket '" << socket_path << "'" << endl;
+		return EX_UNAVAILABLE;
+	}
+	if (!trace_filename.empty()) write_trace(trace_filename);
+	cout << endl << "###################################################" << endl << endl;
+	return EX_OK;
+}
+
+
+/**
+	\brief The client subcommand: send the requests read from the standard input (or given with -e) to a server.
+	
+	Results are written to the standard output, and the closing line of each response to the standard error.
+	
+	\param argc number of arguments (after "client")
+	\param argv the arguments
+	\return exit status
+*/
+
+static int client_main(int argc, char** argv)
+{
+	string socket_path;
+	vector<string> requests;
+	
+	options_description options("Client options");
+	options.add_options()
+		("help,h", "produce help message and exit")
+		("socket,S", value<string>(&socket_path)->default_value("aid-isa.sock"), "Unix domain socket filepath")
+		("request,e", value< vector<string> >(&requests), "request to send (if missing, requests are read from the standard input)");
+	
+	try
+	{
+		variables_map vm;
+		store(command_line_parser(argc, argv).options(options).run(), vm);
+		notify(vm);
+		
+		if (vm.count("help"))
+		{
+			cout << "Usage: AID-ISA client [options]" << endl << options << endl;
+			return EX_OK;
+		}
+	}
+	catch (exception& e)
+	{
+		cerr << e.what() << endl;
+		return EX_USAGE;
+	}
+	
+	bool ok;
+	if (requests.empty()) ok = Server::request(socket_path, cin, cout, cerr);
+	else
+	{
+		ostringstream lines;
+		for(unsigned int i=0; i<requests.size(); i++) lines << requests[i] << endl;
+		istringstream is(lines.str());
+		ok = Server::request(socket_path, is, cout, cerr);
+	}
+	return ok ? EX_OK : EX_UNAVAILABLE;
+}
+
+
+
+/**
+	\brief Return the time of a product, in milliseconds, as the fastest of some repetitions
+	
+	\param E the matrix
+	\param in the vectors
+	\param out the products
+	\param repetitions number of products
+	\param generic set if the generic product is timed, rather than the specialised one
+	\return the time of a product
+*/
+
+static double time_product(Matrix& E, const floatmatrix& in, floatmatrix& out, unsigned int repetitions, bool generic)
+{
+	double fastest = numeric_limits<double>::max();
+	for (unsigned int k=0; k<repetitions; k++)
+	{
+		double start = omp_get_wtime();
+		if (generic) E.generic_product(in, out);
+		else E.batch_product(in, out);
+		fastest = min(fastest, omp_get_wtime() - start);
+	}
+	return 1000.0*fastest;
+}
+
+
+/**
+	\brief Return the heap allocations of an ISA trajectory once its workspace has been warmed up (\see IsaWorkspace)
+	
+	The trajectories start from the same seeds twice: the first pass grows the workspace, the second one is counted.
+	
+	\param E_g the transposed and normalized gene expression matrix
+	\param E the normalized gene expression matrix
+	\param gene_driver distance matrix for the gene dimension, empty for ISA
+	\param repetitions number of trajectories
+	\param counted set if allocations are counted (\see Memory::allocations)
+	\return the allocations per trajectory
+*/
+
+static double isa_allocations(Matrix& E_g, Matrix& E, Driver& gene_driver, unsigned int repetitions, bool& counted)
+{
+	Driver no_driver;
+	IsaWorkspace workspace;
+	Bicluster seed, b;
+	unsigned long before = 0, after = 0;
+	for (unsigned int pass=0; pass<2; pass++)
+	{
+		Memory::allocations(before);
+		for (unsigned int t=0; t<repetitions; t++)
+		{
+			random_generator seed_rng(0, t);
+			seed.initializeSignature(E.getRowsNumber(), seed_rng);
+			b = seed;
+			b.iterativeSignatureAlgorithm(E_g, E, min_gene_threshold, min_condition_threshold, gene_driver, no_driver, 2.0, 0.5, gene_driver.getRowsNumber() > 0, 0, &workspace);
+		}
+		counted = Memory::allocations(after);
+	}
+	return (double) (after - before)/repetitions;
+}
+
+
+/**
+	\brief The benchmark subcommand: time the product kernels of each storage backend and accumulator.
+	
+	The products of the normalized input with a batch of random vectors are evaluated by the kernel specialised 
+	at compile time (\see Matrix::batch_product) and, for dense matrices, by the generic one, which chooses the 
+	kernel row by row. Each time is the fastest of the repetitions.
+	
+	For dense matrices, it also checks the heap allocations of ISA and AID-ISA trajectories, the latter driven by 
+	a view of random gene distances as in filtered runs (\see isa_allocations); they are counted only if built with 
+	make ALLOCATION_STATS=1.
+	
+	\param argc number of arguments (after "benchmark")
+	\param argv the arguments
+	\return exit status, EX_SOFTWARE if the trajectories allocate
+*/
+
+static int benchmark_main(int argc, char** argv)
+{
+	string input_filename;
+	unsigned int batch_size;
+	unsigned int repetitions;
+	bool sparse;
+	bool out_of_core;
+	
+	options_description options("Benchmark options");
+	options.add_options()
+		("help,h", "produce help message and exit")
+		("input,i", value<string>(&input_filename), "gene expression data input filepath")
+		("batch,b", value<unsigned int>(&batch_size)->default_value(1), "number of vectors of each product")
+		("repetitions,r", value<unsigned int>(&repetitions)->default_value(20), "number of timed products")
+		("sparse", bool_switch(&sparse), "the input is a Matrix Market or (gene, condition, value) triplet file")
+		("out_of_core", bool_switch(&out_of_core), "the input is a binary file, which is streamed from disk");
+	
+	positional_options_description pos;
+	pos.add("input", 1);
+	
+	try
+	{
+		variables_map vm;
+		store(command_line_parser(argc, argv).options(options).positional(pos).run(), vm);
+		notify(vm);
+		
+		if (vm.count("help") || !vm.count("input") || repetitions == 0)
+		{
+			cout << "Usage: AID-ISA benchmark input [options]" << endl << options << endl;
+			return vm.count("help") ? EX_OK : EX_USAGE;
+		}
+	}
+	catch (exception& e)
+	{
+		cerr << e.what() << endl;
+		return EX_USAGE;
+	}
+	
+	Matrix E;
+	if (sparse) E.loadSparseFromFile(const_cast<char *>(input_filename.c_str()));
+	else if (out_of_core) E.mapFromFile(const_cast<char *>(input_filename.c_str()));
+	else E.loadFromFile(const_cast<char *>(input_filename.c_str()));
+	if (E.getRowsNumber() == 0)
+	{
+		cout << "ERROR: I cannot open the file '" << input_filename << "', or its rows differ in length" << endl;
+		return EX_DATAERR;
+	}
+	Matrix E_g; //the normalized traspose, for the ISA trajectories
+	if (!sparse && !out_of_core)
+	{
+		E_g = E.traspose();
+		E_g.normalize();
+	}
+	E.normalize();
+	
+	random_generator rng(0, 0);
+	floatmatrix in(batch_size, floatvect(E.getColumnsNumber(), 0.0));
+	for (unsigned int b=0; b<batch_size; b++)
+		for (unsigned int j=0; j<in[b].size(); j++)
+			in[b][j] = rng.value(1000)/1000.0;
+	
+	const char* precision_names[] = { "fp32", "bf16", "fp16", "int8" };
+	const char* scalar_names[] = { "fp32", "fp64" };
+	unsigned int formats = (sparse || out_of_core) ? 1 : 4;
+	
+	cout << E.getRowsNumber() << " x " << E.getColumnsNumber() << (sparse ? " sparse" : out_of_core ? " out-of-core" : "") << " matrix, " 
+	     << batch_size << " vectors, " << omp_get_max_threads() << " threads" << endl << endl;
+	cout << "storage\taccumulator\tgeneric (ms)\tspecialised (ms)\tgain\tsame products" << endl;
+	for (unsigned int p=0; p<formats; p++)
+		for (unsigned int a=0; a<2; a++)
+		{
+			Matrix M = E.copy();
+			M.compress((precision_t) p);
+			M.setAccumulation((scalar_t) a);
+			
+			floatmatrix generic_out, specialised_out;
+			if (!M.batch_product(in, specialised_out)) //warm up
+			{
+				cout << "ERROR: the rows of '" << input_filename << "' cannot be mapped" << endl;
+				return EX_IOERR;
+			}
+			double specialised = time_product(M, in, specialised_out, repetitions, false);
+			cout << (sparse ? "sparse" : out_of_core ? "file" : precision_names[p]) << "\t" << scalar_names[a] << "\t\t";
+			
+			//sparse and out-of-core matrices have a single backend, so that there is no generic kernel
+			if (sparse || out_of_core)
+			{
+				cout << "-\t\t" << specialised << "\t\t-\t-" << endl;
+				continue;
+			}
+			
+			double generic = time_product(M, in, generic_out, repetitions, true);
+			cout << generic << "\t\t" << specialised << "\t\t" << 100.0*(generic - specialised)/generic << "%\t" 
+			     << (generic_out == specialised_out ? "yes" : "no") << endl;
+		}
+	if (sparse || out_of_core) return EX_OK;
+	
+	Driver no_driver;
+	floatmatrix distances(E.getRowsNumber(), floatvect(E.getRowsNumber(), 0.0));
+	for (unsigned int i=0; i<distances.size(); i++)
+		for (unsigned int j=0; j<i; j++)
+			distances[i][j] = distances[j][i] = rng.value(1000)/1000.0;
+	Driver gene_driver(distances);
+	intvect genes(E.getRowsNumber());
+	iota(genes.begin(), genes.end(), 0);
+	Driver gene_view = gene_driver.view(genes);
+	
+	bool counted = false;
+	double isa = isa_allocations(E_g, E, no_driver, repetitions, counted);
+	double aid = isa_allocations(E_g, E, gene_view, repetitions, counted);
+	cout << endl << "ISA heap allocations per trajectory: ";
+	if (!counted)
+	{
+		cout << "n/a (build with make ALLOCATION_STATS=1)" << endl;
+		return EX_OK;
+	}
+	cout << isa << endl << "AID-ISA heap allocations per trajectory (gene driver view): " << aid << endl;
+	if (isa > 0.0 || aid > 0.0)
+	{
+		cout << "ERROR: the trajectories allocate once their workspace is warmed up" << endl;
+		return EX_SOFTWARE;
+	}
+	return EX_OK;
+}
 
 
 
 int main(int argc, char** argv)
 {
+	if (argc > 1 && strcmp(argv[1], "merge") == 0) return merge_main(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "serve") == 0) return serve_main(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "client") == 0) return client_main(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "benchmark") == 0) return benchmark_main(argc - 1, argv + 1);
 	
 	/*
 	 * List of command line parameters, and object used throughtout 
@@ -50,19 +804,58 @@ int main(int argc, char** argv)
 	
 	string input_filename;
 	string output_filename;
-	bool if_row_driver;
-	bool if_col_driver;
-	unsigned int runs_number;
-	float delta_expand;
-	float delta_reduce;
+	JobConfig job;
 	string gene_filename;
 	string condition_filename;
-	string gene_driver_filename;
-	string condition_driver_filename;
+	vector<string> gene_sources;
+	vector<string> condition_sources;
+	string gene_weights;
+	string condition_weights;
+	string gene_missing;
+	string condition_missing;
+	bool gene_annotations;
+	bool condition_annotations;
+	unsigned int driver_cache;
+	bool gene_embeddings;
+	bool condition_embeddings;
+	string metric_name;
+	metric_t metric = metric_euclidean;
+	float ann_recall;
+	bool ann_validate;
+	string precision_name;
+	precision_t precision = precision_fp32;
+	string accumulation_name;
+	scalar_t accumulation = scalar_fp32;
+	bool validate_precision;
+	bool out_of_core;
+	bool sparse;
+	string binary_filename;
+	string numa_name;
+	string huge_pages_name;
+	numa_policy_t numa_policy = numa_default;
+	huge_pages_t huge_pages = huge_pages_none;
+	bool prefault;
+	bool pin_threads;
+	bool memory_stats;
+	string trace_filename;
+	unsigned int trace_events;
+	string warm_filename;
+	string gene_subset_filename;
+	float min_gene_variance;
+	float gene_variance_quantile;
+	float gene_expression_quantile;
+	string condition_subset_filename;
+	string shard_name;
+	bool sharded = false;
+	float overlap;
+	bool score;
+	unsigned int top;
+	string rank_name;
+	quality_t rank_by = quality_correlation;
+	unsigned int permutations;
+	unsigned int bootstraps;
 	
-	Matrix E;
-	Driver gene_driver;
-	Driver condition_driver;		    
+	Engine engine;
 	stringvect geneList;
 	stringvect conditionList;
 
@@ -87,16 +880,61 @@ int main(int argc, char** argv)
 			
 		options_description parameter("Optional parameters");
 		parameter.add_options()
-			("gene_ida?,G", value<bool>(&if_row_driver)->default_value(false), "whether additional information are provided for gene dimension")
-			("condition_ida?,C", value<bool>(&if_col_driver)->default_value(false), "whether additional information are provided for condition dimension")
-			("gene_information,g", value<string>(&gene_driver_filename), "additional information for gene dimension")
-			("condition_information,c", value<string>(&condition_driver_filename), "additional information for condition dimension")
+			("gene_ida?,G", value<bool>(&job.if_row_driver)->default_value(false), "whether additional information are provided for gene dimension")
+			("condition_ida?,C", value<bool>(&job.if_col_driver)->default_value(false), "whether additional information are provided for condition dimension")
+			("gene_information,g", value< vector<string> >(&gene_sources)->composing(), "additional information for gene dimension, [distances:|annotations:|embeddings:]FILE (repeat to fuse several sources)")
+			("condition_information,c", value< vector<string> >(&condition_sources)->composing(), "additional information for condition dimension, [distances:|annotations:|embeddings:]FILE (repeat to fuse several sources)")
+			("gene_weights", value<string>(&gene_weights), "comma separated weights of the gene sources (default 1)")
+			("condition_weights", value<string>(&condition_weights), "comma separated weights of the condition sources (default 1)")
+			("gene_missing", value<string>(&gene_missing), "comma separated distances replacing missing values (-1) of each gene source, or skip (default)")
+			("condition_missing", value<string>(&condition_missing), "comma separated distances replacing missing values (-1) of each condition source, or skip (default)")
+			("gene_annotations", bool_switch(&gene_annotations), "gene_information lists the annotation terms of each gene, rather than distances")
+			("condition_annotations", bool_switch(&condition_annotations), "condition_information lists the annotation terms of each condition, rather than distances")
+			("driver_cache", value<unsigned int>(&driver_cache)->default_value(256), "MB of distance rows cached for each annotation driver")
+			("gene_embeddings", bool_switch(&gene_embeddings), "gene_information lists the embedding of each gene, rather than distances")
+			("condition_embeddings", bool_switch(&condition_embeddings), "condition_information lists the embedding of each condition, rather than distances")
+			("metric", value<string>(&metric_name)->default_value("euclidean"), "distance between embeddings (euclidean, cosine)")
+			("ann_recall", value<float>(&ann_recall)->default_value(0.0), "expand clusters through an approximate index of annotations or embeddings, retrieving this fraction of the objects (0 for exact expansion)")
+			("ann_validate", bool_switch(&ann_validate), "report how the approximate expansions differ from the exact ones")
 			("output,o", value<string>(&output_filename),  "AID-ISA output filepath")
-			("runs,n", value<unsigned int>(&runs_number)->default_value(10), "number of random initial seeds to use")
-			("d_reduction,r", value<float>(&delta_reduce)->default_value(2.0), "delta for AID reduction step")
-			("d_expansion,e", value<float>(&delta_expand)->default_value(0.5), "delta for AID expansion step")
+			("runs,n", value<unsigned int>(&job.runs_number)->default_value(10), "number of random initial seeds to use")
+			("warm_start", value<string>(&warm_filename), "previous results (e.g., before conditions were added), whose biclusters are mapped by labels and evaluated as initial seeds before the random ones")
+			("saturation", value<float>(&job.saturation)->default_value(0.0), "stop once fewer new biclusters than this are expected from the next run, runs being the largest number of runs (0 to evaluate all the runs)")
+			("time_budget", value<double>(&job.time_budget)->default_value(0.0), "seconds given to the search, after which the biclusters found so far are saved; the most productive thresholds are evaluated first (0 for no deadline)")
+			("d_reduction,r", value<float>(&job.delta_reduce)->default_value(2.0), "delta for AID reduction step")
+			("d_expansion,e", value<float>(&job.delta_expand)->default_value(0.5), "delta for AID expansion step")
 			("gene_labels,x", value<string>(&gene_filename ),  "gene labels")
-			("condition_label,y", value<string>(&condition_filename),  "condition labels");
+			("condition_labels,y", value<string>(&condition_filename),  "condition labels")
+			("min_gene_variance", value<float>(&min_gene_variance)->default_value(0.0), "drop the genes whose expression variance is lower, before normalization")
+			("gene_variance_quantile", value<float>(&gene_variance_quantile)->default_value(0.0), "drop this fraction of the genes, those whose expression variance is lowest, before normalization")
+			("gene_expression_quantile", value<float>(&gene_expression_quantile)->default_value(0.0), "drop this fraction of the genes, those whose mean expression is lowest, before normalization")
+			("gene_subset", value<string>(&gene_subset_filename), "run on the genes listed in this file (one label per line), viewing the data in place")
+			("condition_subset", value<string>(&condition_subset_filename), "run on the conditions listed in this file (one label per line), viewing the data in place")
+			("precision,p", value<string>(&precision_name)->default_value("fp32"), "storage format of the normalized data (fp32, bf16, fp16, int8)")
+			("accumulation", value<string>(&accumulation_name)->default_value("fp32"), "accumulator of the matrix products (fp32, fp64)")
+			("validate_precision", bool_switch(&validate_precision), "report how many biclusters differ from those found on fp32 data")
+			("make_binary", value<string>(&binary_filename), "convert the input to a binary file for out_of_core, and exit")
+			("out_of_core", bool_switch(&out_of_core), "the input is a binary file, which is streamed from disk rather than loaded")
+			("sparse", bool_switch(&sparse), "the input is a Matrix Market or (gene, condition, value) triplet file, and only nonzero entries are stored")
+			("batch,b", value<unsigned int>(&job.batch_size)->default_value(1), "number of (seed, thresholds) pairs evaluated in a single pass over the data")
+			("numa", value<string>(&numa_name)->default_value("none"), "placement of data and additional information on NUMA nodes (none, interleave, partition)")
+			("huge_pages", value<string>(&huge_pages_name)->default_value("none"), "page size of data and additional information (none, transparent, explicit)")
+			("prefault", bool_switch(&prefault), "touch data and additional information pages while loading")
+			("pin_threads", bool_switch(&pin_threads), "pin threads to NUMA nodes, in the order rows are partitioned")
+			("memory_stats", bool_switch(&memory_stats), "report memory placement counters")
+			("trace", value<string>(&trace_filename), "record a timeline of the run (phases, seeds, iterations and threads), and save it in this file as a Chrome trace, which opens in Perfetto")
+			("trace_events", value<unsigned int>(&trace_events)->default_value(65536), "events kept by each thread while tracing (the oldest are overwritten)")
+			("consolidate", value<float>(&overlap)->default_value(0.0), "merge biclusters sharing at least this fraction of their cells (0 to keep them all; sharded runs consolidate on merge)")
+			("score", bool_switch(&score), "write the quality scores of each bicluster (residue, correlation, coherence, gene_distance, condition_distance)")
+			("top", value<unsigned int>(&top)->default_value(0), "keep only the best biclusters by rank_by, scoring them (0 to keep them all)")
+			("rank_by", value<string>(&rank_name)->default_value("correlation"), "score ranking the biclusters kept by top, and tested by permutations")
+			("permutations", value<unsigned int>(&permutations)->default_value(0), "rerun on this many permuted data sets, and write the empirical p-value of rank_by for each bicluster")
+			("bootstrap", value<unsigned int>(&bootstraps)->default_value(0), "rerun on this many bootstrap samples of the conditions, and write the stability of each bicluster")
+			("seed,s", value<unsigned long>(&job.seed)->default_value(time(NULL), "time"), "random seed")
+			("shard", value<string>(&shard_name), "evaluate only the shard i/N of the (run, threshold) grid, and save a partial result to be merged")
+			("checkpoint", value<string>(&job.checkpoint_filename), "save the progress of the run in this file, periodically and on SIGTERM/SIGINT")
+			("checkpoint_interval", value<unsigned int>(&job.checkpoint_interval)->default_value(300), "seconds between two checkpoints")
+			("resume", bool_switch(&job.resume), "resume the run saved in the checkpoint");
         
         options_description cmdline_options;
         cmdline_options.add(generic).add(mandatory).add(parameter);
@@ -113,6 +951,10 @@ int main(int argc, char** argv)
 		if (vm.count("help")) 
 		{
 			cout << "Usage: AID-ISA input gene_ida? condition_ida? [gene_information, condition_information, output, runs, d_reduction, d_expansion, gene_labels, condition_labels]" << endl << cmdline_options << endl;
+			cout << "       AID-ISA merge partial [partial ...] [output, gene_labels, condition_labels]" << endl;
+			cout << "       AID-ISA serve [socket, workers]" << endl;
+			cout << "       AID-ISA client [socket, request]" << endl;
+			cout << "       AID-ISA benchmark input [batch, repetitions, sparse, out_of_core]" << endl;
 			cout << endl << "If gene_ida? is true gene_information MUST be supplied" << endl;
 			cout << "If condition_isa? is true  condition_information MUST be supplied" << endl;
 			
@@ -130,6 +972,151 @@ int main(int argc, char** argv)
 		
 		cout << endl << "###################   AID-ISA   ###################" << endl << endl;
 		
+		if (!Matrix::parsePrecision(precision_name, precision) || !Matrix::parseScalar(accumulation_name, accumulation))
+		{
+			cerr << "ERROR: unknown precision '" << precision_name << "' or accumulator '" << accumulation_name << "'" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (!Driver::parseMetric(metric_name, metric) || (gene_annotations && gene_embeddings) || (condition_annotations && condition_embeddings))
+		{
+			cerr << "ERROR: unknown metric '" << metric_name << "', or additional information given both as annotations and as embeddings" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (overlap < 0.0 || overlap > 1.0)
+		{
+			cerr << "ERROR: consolidate must be in [0, 1]" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (!Engine::parseQuality(rank_name, rank_by))
+		{
+			cerr << "ERROR: unknown score '" << rank_name << "'" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if ((score || top > 0 || permutations > 0 || bootstraps > 0) && vm.count("shard"))
+		{
+			cerr << "ERROR: sharded runs cannot be scored" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (ann_recall < 0.0 || ann_recall >= 1.0)
+		{
+			cerr << "ERROR: ann_recall must be in [0, 1)" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (!Memory::parseNumaPolicy(numa_name, numa_policy) || !Memory::parseHugePages(huge_pages_name, huge_pages))
+		{
+			cerr << "ERROR: unknown NUMA policy '" << numa_name << "' or page size '" << huge_pages_name << "'" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (vm.count("shard") && (sscanf(shard_name.c_str(), "%u/%u", &job.shard, &job.shards) != 2 || job.shards == 0 || job.shard >= job.shards))
+		{
+			cerr << "ERROR: shard must be i/N, with i < N" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if ((permutations > 0 || bootstraps > 0) && (sparse || out_of_core))
+		{
+			cerr << "ERROR: sparse and out_of_core inputs cannot be resampled" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		bool filter = min_gene_variance > 0.0 || gene_variance_quantile > 0.0 || gene_expression_quantile > 0.0;
+		if (min_gene_variance < 0.0 || gene_variance_quantile < 0.0 || gene_variance_quantile >= 1.0 || gene_expression_quantile < 0.0 || gene_expression_quantile >= 1.0 || 
+		    (filter && (sparse || out_of_core)))
+		{
+			cerr << "ERROR: min_gene_variance must be non-negative, gene_variance_quantile and gene_expression_quantile in [0, 1), and sparse and out_of_core inputs cannot be filtered" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		bool subset = vm.count("gene_subset") || vm.count("condition_subset");
+		if (subset && (sparse || out_of_core || permutations > 0 || bootstraps > 0))
+		{
+			cerr << "ERROR: subsets cannot be taken of sparse and out_of_core inputs, nor resampled" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (sparse && out_of_core)
+		{
+			cerr << "ERROR: sparse and out_of_core inputs cannot be combined" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		sharded = vm.count("shard");
+		
+		if (sharded && vm["seed"].defaulted())
+		{
+			cerr << "ERROR: sharded runs need an explicit seed, the same for all shards" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (job.saturation < 0.0 || (job.saturation > 0.0 && (sharded || vm.count("checkpoint"))))
+		{
+			cerr << "ERROR: saturation must be non-negative, and it cannot be combined with shard or checkpoint" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (job.time_budget < 0.0)
+		{
+			cerr << "ERROR: time_budget must be non-negative" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		if (job.resume && !vm.count("checkpoint"))
+		{
+			cerr << "ERROR: If resume is set checkpoint MUST be supplied" << endl;
+			cout << endl << "###################################################" << endl << endl;
+			cout << "Usage: " << endl << cmdline_options << endl;
+			return EX_USAGE;
+		}
+		
+		//a resumed run draws the seeds of the saved one, unless its seed is given
+		if (job.resume && vm["seed"].defaulted() && !Checkpoint::readSeed(job.checkpoint_filename, job.seed))
+		{
+			cout << "ERROR: I cannot read the random seed of the checkpoint '" << job.checkpoint_filename << "'" << endl;
+			return EX_DATAERR;
+		}
+		
+		//buffers are placed as they are loaded, by the threads that will read them
+		if (pin_threads) Memory::pinThreads();
+		Memory::configure(numa_policy, huge_pages, prefault);
+		if (!trace_filename.empty()) Trace::enable(trace_events);
+		
 		//read the mandatory
 		if (!vm.count("input"))
 		{
@@ -139,59 +1126,84 @@ int main(int argc, char** argv)
 			return EX_USAGE;
 		}
 		
+		//Shall I only convert the input?
+		if (vm.count("make_binary"))
+		{
+			cout << "Converting data..." << endl;	
+			if (!Matrix::convertToBinary(const_cast<char *>(input_filename.c_str()), const_cast<char *>(binary_filename.c_str())))
+			{
+				cout << "ERROR: I cannot convert the file '" << input_filename << "' to '" << binary_filename << "'" << endl;
+				return EX_DATAERR;
+			}
+			cout << "\t done." << endl;
+			return EX_OK;
+		}
+		
 		//Shall I use gene information?
-		if(if_row_driver && !vm.count("gene_information"))
+		if(job.if_row_driver && !vm.count("gene_information"))
 		{
 			cerr << "ERROR: If gene_ida? is true gene_information MUST be supplied" << endl;
 			cout << endl << "###################################################" << endl << endl;
 			cout << "Usage: " << endl << cmdline_options << endl;
 			return EX_USAGE;
 		}
-		else if(if_row_driver && vm.count("gene_information"))
+		else if(job.if_row_driver && vm.count("gene_information"))
 		{
 			cout << "Loading additional information (gene)..." << endl;	
-			gene_driver.loadFromFile(const_cast<char *>(gene_driver_filename.c_str()));
-			if (gene_driver.getRowsNumber() == 0)
+			string kind = gene_annotations ? "annotations" : gene_embeddings ? "embeddings" : "distances";
+			for (unsigned int k=0; k<gene_sources.size(); k++)
+				if (!engine.loadGeneSource(gene_sources[k], kind, (size_t) driver_cache << 20, metric))
+				{
+					cout << "ERROR: no additional information provided in file '" << gene_sources[k] << "', or its genes differ from those of the other sources" << endl;
+					return EX_DATAERR;
+				}
+			floatvect weights, missing;
+			if (!Engine::parseFusion(gene_weights, gene_missing, gene_sources.size(), weights, missing) || !engine.weighGeneSources(weights, missing))
 			{
-				cout << "ERROR: no additional information provided in file '" << gene_driver_filename << "'" << endl;
-				return EX_DATAERR;
+				cerr << "ERROR: gene_weights and gene_missing must list at most one non-negative value (or skip) for each gene source" << endl;
+				return EX_USAGE;
 			}
 			cout << "\t done." << endl;
 		}
 
 		//Shall I use condition information?
-		if(if_col_driver && !vm.count("condition_information"))
+		if(job.if_col_driver && !vm.count("condition_information"))
 		{
 			cerr << "ERROR: If condition_ida? is true condition_information MUST be supplied" << endl; 
 			cout << endl << "###################################################" << endl << endl;
 			cout << "Usage: " << endl << cmdline_options << endl;
 			return EX_USAGE;
 		}
-		else if(if_col_driver && vm.count("condition_information"))
+		else if(job.if_col_driver && vm.count("condition_information"))
 		{
 			cout << "Loading additional information (conditions)..." << endl;	
-			condition_driver.loadFromFile(const_cast<char *>(condition_driver_filename.c_str()));
-			if (condition_driver.getRowsNumber() == 0)
+			string kind = condition_annotations ? "annotations" : condition_embeddings ? "embeddings" : "distances";
+			for (unsigned int k=0; k<condition_sources.size(); k++)
+				if (!engine.loadConditionSource(condition_sources[k], kind, (size_t) driver_cache << 20, metric))
+				{
+					cout << "ERROR: no additional information provided in file '" << condition_sources[k] << "', or its conditions differ from those of the other sources" << endl;
+					return EX_DATAERR;
+				}
+			floatvect weights, missing;
+			if (!Engine::parseFusion(condition_weights, condition_missing, condition_sources.size(), weights, missing) || !engine.weighConditionSources(weights, missing))
 			{
-				cout << "ERROR: no additional information provided in file '" << gene_driver_filename << "'" << endl;
-				return EX_DATAERR;
+				cerr << "ERROR: condition_weights and condition_missing must list at most one non-negative value (or skip) for each condition source" << endl;
+				return EX_USAGE;
 			}
 			cout << "\t done." << endl;			
 		}
 	
 		//--------------------------------------------------------------
 		
-		if(!if_row_driver && !if_col_driver)
+		if(!job.if_row_driver && !job.if_col_driver)
 			cout << "The usage of additional information is not required: ISA algorithm will be evaluated" << endl << endl;
 		
 		
 		//reading data (parameter already checked)
 		cout << "Loading data..." << endl;	
-	    E.loadFromFile(const_cast<char *>(input_filename.c_str()));
-		
-		if (E.getRowsNumber() == 0) 
+		if (sparse ? !engine.loadSparseData(input_filename) : !engine.loadData(input_filename, out_of_core))
 		{
-			cout << "ERROR: I cannot open the file '" << input_filename << "'" << endl;
+			cout << "ERROR: I cannot open the file '" << input_filename << "', or its rows differ in length" << endl;
 			return EX_DATAERR;
 		}
 		cout << "\t done." << endl;
@@ -199,45 +1211,59 @@ int main(int argc, char** argv)
 
 		
 	
-		//Gene labels read -if not present mock symbols are used 
-		if (!vm.count("gene_labels"))
-		{
-			geneList = get_mock_elements("R", E.getRowsNumber());
-		}
-		else 
+		geneList = load_labels(gene_filename, engine.getGenesNumber(), "R", "gene");
+		conditionList = load_labels(condition_filename, engine.getConditionsNumber(), "C", "condition");
+		
+		if (filter)
 		{
-			cout << "Loading labels (gene)..." << endl;	
-			geneList = loadListFromFile(const_cast<char *>(gene_filename.c_str()));
-			if (geneList.size() != E.getRowsNumber()) 
+			cout << "Filtering genes..." << endl;
+			if (!engine.filterGenes(min_gene_variance, gene_variance_quantile, gene_expression_quantile))
 			{
-				cout << "WARNING: I cannot open the file '" << gene_filename << "' or there are some problem with the gene list size" << endl;
-				cout << "\t I will return the numeric signature" << endl;
-				geneList = get_mock_elements("R", E.getRowsNumber());
+				cout << "ERROR: no gene passes the filter" << endl;
+				return EX_DATAERR;
 			}
+			
+			//labels follow the kept genes, so that results are saved with the loaded ones
+			const intvect& kept = engine.getKeptGenes();
+			for (unsigned int i=0; i<kept.size(); i++) geneList[i] = geneList[kept[i]];
+			geneList.resize(kept.size());
+			cout << "\t" << kept.size() << "/" << engine.getLoadedGenesNumber() << " genes kept" << endl;
 			cout << "\t done." << endl;
 		}
-
-		//Gene labels read -if not present mock symbol are used 
-		if (!vm.count("condition_labels"))
+		
+		if (!gene_subset_filename.empty() || !condition_subset_filename.empty())
 		{
-			conditionList = get_mock_elements("C", E.getColumnsNumber());
+			cout << "Loading subsets..." << endl;
+			unsigned int gene_unknown = 0, condition_unknown = 0;
+			if ((!gene_subset_filename.empty() && !read_subset(gene_subset_filename, geneList, job.gene_subset, gene_unknown)) ||
+			    (!condition_subset_filename.empty() && !read_subset(condition_subset_filename, conditionList, job.condition_subset, condition_unknown)))
+			{
+				cout << "ERROR: I cannot open the subset files or they list no gene (condition) of the data" << endl;
+				return EX_DATAERR;
+			}
+			if (!job.gene_subset.empty()) cout << "\t" << job.gene_subset.size() << " genes (" << gene_unknown << " labels not found or repeated)" << endl;
+			if (!job.condition_subset.empty()) cout << "\t" << job.condition_subset.size() << " conditions (" << condition_unknown << " labels not found or repeated)" << endl;
+			cout << "\t done." << endl;
 		}
-		else 
+		
+		if (!warm_filename.empty())
 		{
-			cout << "Loading labels (condition)..." << endl;	
-			conditionList = loadListFromFile(const_cast<char *>(condition_filename.c_str()));
-			if (conditionList.size()!= E.getColumnsNumber()) 
+			cout << "Loading warm seeds..." << endl;
+			unsigned int unknown;
+			int read = read_results(warm_filename, geneList, conditionList, job.warm_seeds, unknown);
+			if (read < 0)
 			{
-				cout << "WARNING: I cannot open the file '" << condition_filename << "' or there are some problem with the condition list size" << endl;
-				cout << "\t I will return the numeric signature" << endl;
-				conditionList = get_mock_elements("C", E.getColumnsNumber());
+				cout << "ERROR: I cannot open the file '" << warm_filename << "' or it is not an AID-ISA output" << endl;
+				return EX_DATAERR;
 			}
-			cout << "\t done." << endl;			
+			cout << "\t" << job.warm_seeds.size() << "/" << read << " biclusters mapped (" << unknown << " labels not found)" << endl;
+			cout << "\t done." << endl;
 		}
 		
 		if (!vm.count("output"))
 		{
 			output_filename = input_filename + ".out";
+			if (vm.count("shard")) output_filename = input_filename + ".part" + shard_name.substr(0, shard_name.find('/'));
 			cout << "Data will be saved in " << output_filename << endl;
 		}		
 								
@@ -262,56 +1288,112 @@ int main(int argc, char** argv)
 	
 	
 	cout << endl << "Data pre-processing..." << endl;
-	Matrix E_g = E.traspose();
-	E_g.normalize();
-	Matrix E_c = E.copy();
-	E_c.normalize();
+	engine.prepare(precision, validate_precision && precision != precision_fp32, accumulation);
 	cout << "\t done" << endl;
 	
+	if (ann_recall > 0.0)
+	{
+		cout << endl << "Indexing additional information..." << endl;
+		if (engine.indexDrivers(ann_recall, ann_validate) == 0) cout << "\t no annotations or embeddings: expansion is exact" << endl;
+		else cout << "\t done" << endl;
+	}
+	
+	if (memory_stats) cout << endl << Memory::to_string();
+	
 	/*
 	 * Running AID-ISA
 	 */
 	
-	Biclustervect results;
-
 		//AID-ISA starts from a random sparse seed. 
 		//In this way it is completly stochastic, and at each run it may give
 		//different outputs for the same thresholds.
+		//The random seed is reported, so that a run can be reproduced.
+	
+	cout << endl << "AID-ISA starts (random seed " << job.seed << ")" << endl;
+	if (job.shards > 1) cout << "\tshard " << job.shard << "/" << job.shards << endl;
+	if (!job.checkpoint_filename.empty()) Checkpoint::handleSignals();
+	job.verbose = true; //the progress is printed by the command line only
 	
-	cout << endl << "AID-ISA starts" << endl;
-	for(unsigned int r=0; r<runs_number; r++)
+	Biclustervect results;
+	cellvect found_at;
+	JobStats stats;
+	string partial_header = engine.partialHeader(job);
+	job_status_t status = engine.run(job, results, found_at, NULL, &stats);
+	if (status == job_invalid)
 	{
-		cout << "\tRun: " << r << "/" << runs_number << endl;
-
-		Bicluster initial_signature;
-		initial_signature.initializeSignature(E.getRowsNumber());
-			
-		//the gene_threshold determine the resolution of the modular decomposition. 
-		//By varying it, it is possible to discover multiple biclusters.
-		float condition_threshold = min_condition_threshold;
-		while(condition_threshold <= max_condition_threshold)
+		cout << "ERROR: '" << job.checkpoint_filename << "' is not a checkpoint of the same run" << endl;
+		return EX_DATAERR;
+	}
+	if (status == job_failed)
+	{
+		cout << "ERROR: the rows of '" << input_filename << "' cannot be mapped" << (job.checkpoint_filename.empty() ? "" : ": the run can be resumed from " + job.checkpoint_filename + " (random seed " + to_string(job.seed) + ")") << endl;
+		return EX_IOERR;
+	}
+	if (status == job_interrupted)
+	{
+		cout << endl << "Interrupted: the run can be resumed from " << job.checkpoint_filename << " (random seed " << job.seed << ")" << endl;
+		if (!trace_filename.empty()) write_trace(trace_filename);
+		cout << endl << "###################################################" << endl << endl;
+		return EX_TEMPFAIL;
+	}
+	
+	if (job.saturation > 0.0)
+	{
+		if (stats.saturated) cout << endl << "Discovery saturated after " << stats.runs << "/" << job.warm_seeds.size() + job.runs_number << " runs";
+		else cout << endl << "Discovery did not saturate in " << stats.runs << " runs";
+		cout << " (" << stats.expected_yield << " new biclusters expected from the next run, " << stats.unseen << " not found yet)" << endl;
+	}
+	if (stats.expired) cout << endl << "Time budget elapsed after " << stats.cells << " cells in " << stats.runs << "/" << job.warm_seeds.size() + job.runs_number << " runs" << endl;
+	if (job.saturation > 0.0 || job.time_budget > 0.0)
+	{
+			//replicates evaluate as many runs as the job did, warm ones first
+		unsigned int warm_runs = min(stats.runs, (unsigned int) job.warm_seeds.size());
+		job.warm_seeds.resize(warm_runs);
+		job.runs_number = stats.runs - warm_runs;
+		job.saturation = 0.0;
+		job.time_budget = 0.0;
+	}
+	
+	string index_report = engine.indexReport();
+	if (!index_report.empty()) cout << endl << "Approximate expansion:" << endl << index_report;
+	
+	if (validate_precision && precision != precision_fp32)
+	{
+		cout << endl << "Validating " << precision_name << " against fp32..." << endl;
+		JobConfig reference_job = job;
+		reference_job.reference = true;
+		reference_job.checkpoint_filename = "";
+		Biclustervect reference;
+		cellvect reference_found_at;
+		engine.run(reference_job, reference, reference_found_at);
+		cout << "\t" << count_missing(results, reference) << "/" << results.size() << " " << precision_name << " biclusters are not found on fp32 data" << endl;
+		cout << "\t" << count_missing(reference, results) << "/" << reference.size() << " fp32 biclusters are not found on " << precision_name << " data" << endl;
+	}
+	
+	if (overlap > 0.0 && !sharded) consolidate_results(results, found_at, overlap);
+	
+	Qualityvect scores;
+	if (score || top > 0 || permutations > 0 || bootstraps > 0)
+	{
+		cout << endl << "Scoring biclusters..." << endl;
+		engine.score(results, scores);
+		if (top > 0)
 		{
-			float gene_threshold = min_gene_threshold;
-			while(gene_threshold <= max_gene_threshold)
-			{
-				//each seed will be evaluated on all the possible gene_threshold
-				Bicluster signature = initial_signature.copy();
-				signature.iterativeSignatureAlgorithm(E_g, E_c, gene_threshold, condition_threshold, gene_driver, condition_driver, delta_reduce, delta_expand, if_row_driver, if_col_driver);
-				
-				//void bicluster are discarded
-				if (signature.getGeneCluster().size() != 0)
-				{
-					if (!signature.include(results)) //check if the evaluated bicluster is already known
-					{
-						Bicluster b = signature.copy();
-						results.push_back(b);
-					}
-				}
+			Engine::selectTop(results, found_at, scores, rank_by, top);
+			cout << "\t" << results.size() << " best by " << rank_name << " kept" << endl;
+		}
+		cout << "\t done" << endl;
+	}
 	
-				gene_threshold += gene_threshold_step;
-			}
-			condition_threshold += condition_threshold_step;
+	if (permutations > 0 || bootstraps > 0)
+	{
+		cout << endl << "Resampling (" << permutations << " permutations, " << bootstraps << " bootstrap samples)..." << endl;
+		if (!engine.resample(job, results, scores, permutations, bootstraps, rank_by))
+		{
+			cout << "ERROR: the resampled replicates of '" << input_filename << "' cannot be evaluated" << endl;
+			return EX_DATAERR;
 		}
+		cout << "\t done" << endl;
 	}
 	
 	/*
@@ -319,22 +1401,16 @@ int main(int argc, char** argv)
 	 */
 	
 	cout << endl << "Saving results..." << endl;
-
-	for(unsigned int i=0; i<results.size(); i++)
+	if (sharded)
 	{
-		ostringstream output_str;
-		//bicluster size [row, col]
-		output_str << "[" << results[i].getGeneCluster().size() << ", " << results[i].getConditionCluster().size() << "]" << endl;
-		//map the signature (that are index!) in the name of genes/experiments	
-		output_str << results[i].to_humanString(geneList, conditionList) << endl;
-		printToFile(const_cast<char *>(output_filename.c_str()), output_str.str());
+		unfilter_genes(results, engine.getKeptGenes(), engine.getLoadedGenesNumber());
+		write_partial(output_filename, results, found_at, partial_header);
 	}
+	else write_results(output_filename, results, geneList, conditionList, scores);
 	
 	cout << "\t done" << endl;
+	if (!trace_filename.empty()) write_trace(trace_filename);
 	cout << endl << "###################################################" << endl << endl;
 	return EX_OK;
 
 }
-
-
-
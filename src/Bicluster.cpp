@@ -18,13 +18,16 @@
 //      MA 02110-1301, USA.
 
 #include "Bicluster.hpp"
+#include "Trace.hpp"
 
-Cluster Bicluster::getGeneCluster()
+#include <omp.h>
+
+const Cluster& Bicluster::getGeneCluster() const
 {
 	return gene;
 }
 
-Cluster Bicluster::getConditionCluster()
+const Cluster& Bicluster::getConditionCluster() const
 {
 	return condition;
 }
@@ -68,15 +71,7 @@ string Bicluster::to_string()
 	return output.str();
 }
 
-Bicluster Bicluster::copy()
-{
-	Cluster g = this->gene.copy();
-	Cluster c = this->condition.copy();
-	
-	return Bicluster(g, c);
-}
-
-bool Bicluster::equal(Bicluster b)
+bool Bicluster::equal(const Bicluster& b) const
 {
 	return (this->gene.equal(b.gene)) && (this->condition.equal(b.condition));
 }
@@ -84,7 +79,7 @@ bool Bicluster::equal(Bicluster b)
 
 
 
-bool Bicluster::include(vector<Bicluster> cv)
+bool Bicluster::include(const vector<Bicluster>& cv) const
 {
 	bool found = false;
 	unsigned int i = 0;
@@ -105,53 +100,139 @@ bool Bicluster::include(vector<Bicluster> cv)
 //====================================================================
 
 
-void Bicluster::signatureAlgorithm(Matrix E_R, Matrix E_C, float r_threshold, float c_threshold, Driver row_driver, Driver col_driver,  float reduce_coefficient, float expand_coefficient, unsigned int dd_row, unsigned int dd_col)
+//resize a matrix of vectors, keeping the buffers of the vectors dropped for later growth
+static void resize_recycling(floatmatrix& m, unsigned int n, floatmatrix& spare)
 {
-	Cluster row = this->gene; //reference gene set
-	Cluster col = row.calculate(E_R, c_threshold); //is the condition signature!
-	if (dd_col) col.drive(col_driver, reduce_coefficient, expand_coefficient);
-	row = col.calculate(E_C, r_threshold); //is the gene signature!
-	if (dd_row) row.drive(row_driver, reduce_coefficient, expand_coefficient);
-		
-	this->gene = row;
-	this->condition = col;
+	while (m.size() > n)
+	{
+		spare.push_back(floatvect());
+		spare.back().swap(m.back());
+		m.pop_back();
+	}
+	while (m.size() < n)
+	{
+		m.push_back(floatvect());
+		if (spare.empty()) continue;
+		m.back().swap(spare.back());
+		spare.pop_back();
+	}
 }
 
 
-void Bicluster::iterativeSignatureAlgorithm(Matrix E_R, Matrix E_C, float r_threshold, float c_threshold, Driver row_driver, Driver col_driver,  float reduce_coefficient, float expand_coefficient, unsigned int dd_row, unsigned int dd_col)
+template<bool row_driven, bool col_driven>
+void Bicluster::batchIterate(Bicluster* batch, unsigned int size, Matrix& E_R, Matrix& E_C, const float* r_thresholds, const float* c_thresholds, Driver& row_driver, Driver& col_driver, float reduce_coefficient, float expand_coefficient, IsaWorkspace& w)
 {
-	if (dd_row) this->gene.drive(row_driver, reduce_coefficient, expand_coefficient);
-	bool loop = true;
+	intvect& active = w.active; //signatures still iterating
+	active.clear();
+	for (unsigned int k=0; k<size; k++)
+	{
+		if (row_driven) batch[k].gene.drive(row_driver, reduce_coefficient, expand_coefficient, w.cluster);
+		active.push_back(k);
+	}
+	if (w.cols.size() < size) w.cols.resize(size);
+	
+	w.expired = false;
+	w.failed = false;
+	const bool tracing = Trace::enabled();
+	if (tracing)
+	{
+		w.iterations.assign(size, 0);
+		w.finished.assign(size, 0.0);
+	}
+	
 	int i = 0;
-	while(loop)
+	while(!active.empty() && !w.expired)
 	{
-		Cluster g_seed = this->gene;
-		Cluster c_seed = this->condition;
-		this->signatureAlgorithm(E_R, E_C, r_threshold, c_threshold, row_driver, col_driver, reduce_coefficient, expand_coefficient, dd_row, dd_col);
-		i++;
+		unsigned int n = active.size();
+		Trace::Scope iteration("iteration", "isa", "signatures", n);
+		resize_recycling(w.in, n, w.spare);
+		resize_recycling(w.out, n, w.spare);
+		
+		//condition signatures
+		for (unsigned int k=0; k<n; k++)
+			w.in[k] = batch[active[k]].gene.getCluster();
+		{
+			Trace::Scope phase("condition product", "isa");
+			w.failed = !E_R.batch_product(w.in, w.out);
+		}
+		if (w.failed) break;
 		
-		Cluster new_g_seed = this->gene;
-		Cluster new_c_seed = this->condition;
+		for (unsigned int k=0; k<n; k++)
+		{
+			Bicluster& b = batch[active[k]];
+			w.cols[k].signature(w.out[k], b.gene.size(), c_thresholds[active[k]]);
+			if (col_driven) w.cols[k].drive(col_driver, reduce_coefficient, expand_coefficient, w.cluster);
+			w.in[k] = w.cols[k].getCluster();
+		}
 		
-		//solution found
-		if (g_seed.equal(new_g_seed) && c_seed.equal(new_c_seed) ) loop = false; 
-		if (i > max_isa_runs) //it diverges
+		//gene signatures
 		{
-			//the algorithm returns a void bicluster
-			Cluster void_cluster (this->gene.getCluster().size(), 0.0);
-			this->gene = void_cluster; //if gene cluster if void, also condition cluster will be void
-			loop = false; 
+			Trace::Scope phase("gene product", "isa");
+			w.failed = !E_C.batch_product(w.in, w.out);
 		}
+		if (w.failed) break;
+		i++;
+		if (w.deadline > 0.0 && omp_get_wtime() >= w.deadline) w.expired = true;
+		
+		w.still_active.clear();
+		for (unsigned int k=0; k<n; k++)
+		{
+			Bicluster& b = batch[active[k]];
+			w.row.signature(w.out[k], w.cols[k].size(), r_thresholds[active[k]]);
+			if (row_driven) w.row.drive(row_driver, reduce_coefficient, expand_coefficient, w.cluster);
+			
+			//the previous clusters are kept as buffers of the next signatures
+			bool converged = b.gene.equal(w.row) && b.condition.equal(w.cols[k]);
+			swap(b.gene, w.row);
+			swap(b.condition, w.cols[k]);
+			
+			if (i > max_isa_runs) //it diverges
+				b.gene.reset(b.gene.getCluster().size()); //if gene cluster if void, also condition cluster will be void
+			else if (!converged)
+			{
+				w.still_active.push_back(active[k]);
+				if (!w.expired) continue;
+				b.gene.reset(b.gene.getCluster().size()); //it is abandoned
+			}
+			
+			if (tracing)
+			{
+				w.iterations[active[k]] = i;
+				w.finished[active[k]] = Trace::now();
+			}
+		}
+		active.swap(w.still_active);
 	}
 }
 
 
+//instantiations, indexed by (dd_row, dd_col)
+const Bicluster::batch_iterate_t Bicluster::batch_iterate_kernels[2][2] = {
+	{ &Bicluster::batchIterate<false, false>, &Bicluster::batchIterate<false, true> },
+	{ &Bicluster::batchIterate<true, false>, &Bicluster::batchIterate<true, true> }
+};
+
+
+void Bicluster::iterativeSignatureAlgorithm(Matrix& E_R, Matrix& E_C, float r_threshold, float c_threshold, Driver& row_driver, Driver& col_driver,  float reduce_coefficient, float expand_coefficient, unsigned int dd_row, unsigned int dd_col, IsaWorkspace* workspace)
+{
+	IsaWorkspace temporary;
+	batch_iterate_kernels[dd_row != 0][dd_col != 0](this, 1, E_R, E_C, &r_threshold, &c_threshold, row_driver, col_driver, reduce_coefficient, expand_coefficient, workspace ? *workspace : temporary);
+}
+
+
+void Bicluster::batchIterativeSignatureAlgorithm(vector<Bicluster>& batch, Matrix& E_R, Matrix& E_C, floatvect& r_thresholds, floatvect& c_thresholds, Driver& row_driver, Driver& col_driver, float reduce_coefficient, float expand_coefficient, unsigned int dd_row, unsigned int dd_col, IsaWorkspace* workspace)
+{
+	if (batch.empty()) return;
+	IsaWorkspace temporary;
+	batch_iterate_kernels[dd_row != 0][dd_col != 0](&batch[0], batch.size(), E_R, E_C, &r_thresholds[0], &c_thresholds[0], row_driver, col_driver, reduce_coefficient, expand_coefficient, workspace ? *workspace : temporary);
+}
+
+
 
-void Bicluster::initializeSignature(unsigned int num_genes)
+void Bicluster::initializeSignature(unsigned int num_genes, random_generator& rng)
 {
-	Cluster g(num_genes, 0.0); //it starts by using a void signature (codify by the value 0)
-	this->gene = g;
+	this->gene.reset(num_genes); //it starts by using a void signature (codify by the value 0)
 	
 	int seed_number = (num_genes/100.0)*seed_ratio;
-	this->gene.setRandomSeed(seed_number);
+	this->gene.setRandomSeed(seed_number, rng);
 }
@@ -43,6 +43,33 @@
 using namespace std;
 
 
+/**
+	\brief Buffers of the AID-ISA iterations (\see Bicluster::batchIterativeSignatureAlgorithm).
+	
+	A workspace is owned by a single worker and reused across its seeds: once the buffers have grown to the 
+	sizes of the data set and of the batch, the iterations do not allocate.
+*/
+
+struct IsaWorkspace
+{
+	floatmatrix in; //signatures multiplied by the matrix
+	floatmatrix out; //their products
+	floatmatrix spare; //buffers of the vectors dropped from in and out, for later growth
+	vector<Cluster> cols; //condition signatures
+	Cluster row; //gene signature
+	intvect active; //signatures still iterating (once expired, those abandoned)
+	intvect still_active;
+	ClusterWorkspace cluster;
+	intvect iterations; //iterations of each signature, recorded only when tracing
+	vector<double> finished; //when each signature stopped, recorded only when tracing
+	double deadline; //omp_get_wtime() after which the signatures still iterating are abandoned, 0 for none
+	bool expired; //set if the last batch reached the deadline
+	bool failed; //set if a product of the last batch could not be evaluated (out-of-core matrices)
+
+	IsaWorkspace() : deadline(0.0), expired(false), failed(false) {}
+};
+
+
 /**
 	\brief Bicluster class. 
 	
@@ -63,30 +90,25 @@ private:
 	Cluster condition;
 
 /**
-	\brief Return the results of a run of the AID-SA algorithm [Visconti et al., Intelligent Data Analysis, 2013].
+	\brief Return the results of the AID-ISA algorithm for n signatures, iterated in lockstep.
 	
-	It identifies a transcriptional module given a normalized gene expression matrix and its traspose. 
-	AID-SA starts from a gene cluster and it evaluates the correspondant condition cluster. Then, the obtained 
+	Each iteration runs the AID-SA algorithm [Visconti et al., Intelligent Data Analysis, 2013] on the signatures that 
+	are still active: starting from a gene cluster, it evaluates the correspondant condition cluster. Then, the obtained 
 	condition cluster is thresholded and it is exploited to evaluate the new gene cluster. The gene cluster
 	is also thresholded.
+	
+	Whether AID is performed on each dimension is a template parameter, so that each instantiation has no branch on it.
 
 	\see Cluster.calculate, for a detailed description of these steps.
-	
-		
-	\param E_R the transposed and normalized gene expression matrix
-	\param E_C the normalized gene expression matrix
-	\param r_threshold gene threshols (SA parameter)
-	\param c_threshold condition threshold (SA parameter)
-	\param row_driver distance matrix for the gene dimension
-	\param col_driver distance matrix for the condition dimension
-	\param reduce_coefficient reduction threshold (AID parameter)
-	\param expand_coefficient expansion threshold (AID parameter)
-	\param dd_row set if AID is performed on gene dimension
-	\param dd_col set if AID is performed on condition dimension
+	\see batchIterativeSignatureAlgorithm, for the parameters.
 */	
 
-	void signatureAlgorithm(Matrix E_R, Matrix E_C, float r_threshold, float c_threshold, Driver row_driver, Driver col_driver, float reduce_coefficient, float expand_coefficient, unsigned int dd_row, unsigned int dd_col);
+	template<bool row_driven, bool col_driven>
+	static void batchIterate(Bicluster* batch, unsigned int n, Matrix& E_R, Matrix& E_C, const float* r_thresholds, const float* c_thresholds, Driver& row_driver, Driver& col_driver, float reduce_coefficient, float expand_coefficient, IsaWorkspace& workspace);
 	
+	//instantiations of batchIterate, indexed by (dd_row, dd_col)
+	typedef void (*batch_iterate_t)(Bicluster*, unsigned int, Matrix&, Matrix&, const float*, const float*, Driver&, Driver&, float, float, IsaWorkspace&);
+	static const batch_iterate_t batch_iterate_kernels[2][2];
 
 
 public:
@@ -113,6 +135,17 @@ public:
 		gene = g;
 		condition = c;
 	};
+
+/**
+	\brief Copy and move.
+	
+	A copy assigned to a bicluster of the same size reuses its entries, and a move takes them over.
+*/
+
+	Bicluster(const Bicluster& b) = default;
+	Bicluster(Bicluster&& b) = default;
+	Bicluster& operator=(const Bicluster& b) = default;
+	Bicluster& operator=(Bicluster&& b) = default;
 	
 
 /**
@@ -126,14 +159,14 @@ public:
 	
 	\return gene cluster
 */
-	Cluster getGeneCluster();
+	const Cluster& getGeneCluster() const;
 
 /**
 	\brief  Return cluster on the condition dimension 
 	
 	\return condition cluster
 */
-	Cluster getConditionCluster();
+	const Cluster& getConditionCluster() const;
 	
 /**
 	\brief Set the cluster on the gene dimension to g
@@ -149,13 +182,6 @@ public:
 */
 	void setConditionCluster(Cluster& c);
 	
-/**
-	\brief Return a copy of the bicluster
-	
-	\return a copy of the bicluster
-*/
-	Bicluster copy();
-
 /**
    \brief Return whether two biclusters are equal. 
    Two biclusters are equal iff their cluster are equals, i.e. their index in the dta matrix are the same.
@@ -163,7 +189,7 @@ public:
    \param b bicluster to compare
    \return true, if the biclusters are equal, false otherwise
 */   
-	bool equal(Bicluster b);
+	bool equal(const Bicluster& b) const;
 	
 
 /**
@@ -173,7 +199,7 @@ public:
 	\return true if the vectors contains the bicluster, false otherwise
 */
 
-	bool include(vector<Bicluster> cv);
+	bool include(const vector<Bicluster>& cv) const;
 	
 /**
 	\brief Return a string representing the bicluster
@@ -213,8 +239,9 @@ public:
 	Both the number of genes and the uniform value are global parameter.
 	
 	\param num_genes number of genes in the data set
+	\param rng the random generator
 */
-	void initializeSignature(unsigned int num_genes);
+	void initializeSignature(unsigned int num_genes, random_generator& rng);
 	
 
 /**
@@ -223,6 +250,8 @@ public:
 	It evaluates the AID-SA algorithm until the convegence criteria is reached (i.e., the element in both the gene and the condition does not change) or until the initial seed is proved to be divergent (i.e. the number of
 	iteration exceded a global parameter). 
 	In the latter case a void bicluser is returned.
+	The instantiation specialised for dd_row and dd_col is picked from a dispatch table, and the bicluster is iterated as 
+	a batch of one.
 	
 	\param E_R the transposed and normalized gene expression matrix
 	\param E_C the normalized gene expression matrix
@@ -234,9 +263,37 @@ public:
 	\param expand_coefficient expansion threshold (AID parameter)
 	\param dd_row set if AID is performed on gene dimension
 	\param dd_col set if AID is performed on condition dimension
+	\param workspace buffers to reuse, or NULL to use temporary ones
+*/	
+
+	void iterativeSignatureAlgorithm(Matrix& E_R, Matrix& E_C, float r_threshold, float c_threshold, Driver& row_driver, Driver& col_driver, float reduce_coefficient, float expand_coefficient, unsigned int dd_row, unsigned int dd_col, IsaWorkspace* workspace = NULL);
+
+/**
+	\brief Return the results of the AID-ISA algorithm for a batch of initial signatures, each with its own thresholds.
+	
+	Signatures are iterated in lockstep, so that each half-iteration evaluates the products of all the 
+	signatures that have not yet converged (or diverged) in a single pass over the matrix. Each bicluster 
+	is the same that iterativeSignatureAlgorithm would return, unless the deadline of the workspace is 
+	reached: the signatures still iterating are then abandoned as void, and the workspace is marked expired. If a 
+	product cannot be evaluated, the iterations stop at once and the workspace is marked failed.
+	
+	\see iterativeSignatureAlgorithm
+	
+	\param batch the initial signatures, replaced by the results
+	\param E_R the transposed and normalized gene expression matrix
+	\param E_C the normalized gene expression matrix
+	\param r_thresholds gene threshols (SA parameter), one for each signature
+	\param c_thresholds condition thresholds (SA parameter), one for each signature
+	\param row_driver distance matrix for the gene dimension
+	\param col_driver distance matrix for the condition dimension
+	\param reduce_coefficient reduction threshold (AID parameter)
+	\param expand_coefficient expansion threshold (AID parameter)
+	\param dd_row set if AID is performed on gene dimension
+	\param dd_col set if AID is performed on condition dimension
+	\param workspace buffers to reuse, or NULL to use temporary ones
 */	
 
-	void iterativeSignatureAlgorithm(Matrix E_R, Matrix E_C, float r_threshold, float c_threshold, Driver row_driver, Driver col_driver, float reduce_coefficient, float expand_coefficient, unsigned int dd_row, unsigned int dd_col);
+	static void batchIterativeSignatureAlgorithm(vector<Bicluster>& batch, Matrix& E_R, Matrix& E_C, floatvect& r_thresholds, floatvect& c_thresholds, Driver& row_driver, Driver& col_driver, float reduce_coefficient, float expand_coefficient, unsigned int dd_row, unsigned int dd_col, IsaWorkspace* workspace = NULL);
 
 
 
@@ -0,0 +1,217 @@
+//      Checkpoint.cpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#include "Checkpoint.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <sys/time.h>
+
+static const char checkpoint_magic[8] = {'A', 'I', 'D', 'C', 'K', 'P', 'T', '2'};
+
+static volatile sig_atomic_t termination_requested = 0;
+
+static void request_termination(int)
+{
+	termination_requested = 1;
+}
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+template <class T> static void put(ostream& os, T value)
+{
+	os.write((const char*) &value, sizeof(value));
+}
+
+template <class T> static bool get(istream& is, T& value)
+{
+	return (bool) is.read((char*) &value, sizeof(value));
+}
+
+//cluster objects are saved as a list of indices
+static void put_cluster(ostream& os, const Cluster& c)
+{
+	intvect elements = c.getElements();
+	put<uint32_t>(os, elements.size());
+	for (unsigned int i=0; i<elements.size(); i++)
+		put<uint32_t>(os, elements[i]);
+}
+
+static bool get_cluster(istream& is, unsigned int n, Cluster& c)
+{
+	uint32_t size, index;
+	if (!get(is, size) || size > n) return false;
+	c = Cluster(n, 0.0);
+	for (unsigned int i=0; i<size; i++)
+	{
+		if (!get(is, index) || index >= n) return false;
+		c.setValue(index, 1.0);
+	}
+	return true;
+}
+
+
+
+Checkpoint::Checkpoint(const string& f, unsigned int i, unsigned int g, unsigned int c, unsigned int r, unsigned int cpr, unsigned long s, unsigned int sh, unsigned int shs, float dr, float de, bool dd_row, bool dd_col, uint64_t h)
+	: filename(f), interval(i), last_save(now()), num_genes(g), num_conditions(c), runs(r), shard(sh), shards(shs), cells_per_run(cpr), seed(s),
+	  delta_reduce(dr), delta_expand(de), drivers((dd_row ? 1 : 0) | (dd_col ? 2 : 0)), data_hash(h), done((size_t)r*cpr, false)
+{
+}
+
+
+bool Checkpoint::isDone(unsigned long cell)
+{
+	return done[cell];
+}
+
+
+void Checkpoint::setDone(unsigned long cell)
+{
+	done[cell] = true;
+}
+
+
+unsigned long Checkpoint::doneNumber()
+{
+	return count(done.begin(), done.end(), true);
+}
+
+
+bool Checkpoint::update(vector<Bicluster>& results, vector<unsigned long>& found_at)
+{
+	if (!termination_requested && now() - last_save < interval) return true;
+	return save(results, found_at);
+}
+
+
+bool Checkpoint::save(vector<Bicluster>& results, vector<unsigned long>& found_at)
+{
+	string tmp_filename = filename + ".tmp";
+	ofstream os(tmp_filename.c_str(), ios::binary);
+	if (!os) return false;
+
+	os.write(checkpoint_magic, sizeof(checkpoint_magic));
+	put(os, num_genes);
+	put(os, num_conditions);
+	put(os, runs);
+	put(os, shard);
+	put(os, shards);
+	put(os, cells_per_run);
+	put(os, seed);
+	put(os, delta_reduce);
+	put(os, delta_expand);
+	put(os, drivers);
+	put(os, data_hash);
+
+	//evaluated cells, as a bitmap
+	for (size_t k=0; k<done.size(); k+=8)
+	{
+		uint8_t byte = 0;
+		for (size_t b=0; b<8 && k+b<done.size(); b++)
+			if (done[k+b]) byte |= 1 << b;
+		put(os, byte);
+	}
+
+	put<uint32_t>(os, results.size());
+	for (unsigned int i=0; i<results.size(); i++)
+	{
+		put<uint64_t>(os, found_at[i]);
+		put_cluster(os, results[i].getGeneCluster());
+		put_cluster(os, results[i].getConditionCluster());
+	}
+
+	os.close();
+	if (!os || rename(tmp_filename.c_str(), filename.c_str()) != 0) return false;
+
+	last_save = now();
+	return true;
+}
+
+
+bool Checkpoint::load(vector<Bicluster>& results, vector<unsigned long>& found_at)
+{
+	ifstream is(filename.c_str(), ios::binary);
+	char magic[sizeof(checkpoint_magic)];
+	if (!is.read(magic, sizeof(magic)) || memcmp(magic, checkpoint_magic, sizeof(magic)) != 0) return false;
+
+	//the snapshot must refer to this run
+	Checkpoint saved(*this);
+	if (!get(is, saved.num_genes) || !get(is, saved.num_conditions) || !get(is, saved.runs) || !get(is, saved.shard) || !get(is, saved.shards) ||
+	    !get(is, saved.cells_per_run) || !get(is, saved.seed) || !get(is, saved.delta_reduce) || !get(is, saved.delta_expand) || !get(is, saved.drivers) ||
+	    !get(is, saved.data_hash)) return false;
+	if (saved.num_genes != num_genes || saved.num_conditions != num_conditions || saved.runs != runs || saved.shard != shard || saved.shards != shards ||
+	    saved.cells_per_run != cells_per_run || saved.seed != seed || saved.delta_reduce != delta_reduce || saved.delta_expand != delta_expand || saved.drivers != drivers ||
+	    saved.data_hash != data_hash) return false;
+
+	for (size_t k=0; k<done.size(); k+=8)
+	{
+		uint8_t byte;
+		if (!get(is, byte)) return false;
+		for (size_t b=0; b<8 && k+b<done.size(); b++)
+			done[k+b] = (byte >> b) & 1;
+	}
+
+	uint32_t n;
+	if (!get(is, n)) return false;
+	for (unsigned int i=0; i<n; i++)
+	{
+		uint64_t cell;
+		Cluster g, c;
+		if (!get(is, cell) || !get_cluster(is, num_genes, g) || !get_cluster(is, num_conditions, c)) return false;
+		results.push_back(Bicluster(g, c));
+		found_at.push_back(cell);
+	}
+	return true;
+}
+
+
+bool Checkpoint::readSeed(const string& filename, unsigned long& seed)
+{
+	ifstream is(filename.c_str(), ios::binary);
+	char magic[sizeof(checkpoint_magic)];
+	if (!is.read(magic, sizeof(magic)) || memcmp(magic, checkpoint_magic, sizeof(magic)) != 0) return false;
+
+	//the seed follows six 32 bit parameters (\see save)
+	uint32_t parameter;
+	uint64_t saved_seed;
+	for (unsigned int k=0; k<6; k++)
+		if (!get(is, parameter)) return false;
+	if (!get(is, saved_seed)) return false;
+	seed = saved_seed;
+	return true;
+}
+
+
+void Checkpoint::handleSignals()
+{
+	signal(SIGTERM, request_termination);
+	signal(SIGINT, request_termination);
+}
+
+
+bool Checkpoint::terminationRequested()
+{
+	return termination_requested;
+}
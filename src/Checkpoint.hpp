@@ -0,0 +1,169 @@
+//      Checkpoint.hpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "utilities.h"
+#include "Bicluster.hpp"
+
+using namespace std;
+
+
+
+/**
+	\brief Checkpoint class.
+
+	A checkpoint is a binary snapshot of a run: the parameters identifying it, the grid cells
+	already evaluated, and the biclusters found so far (with the cell where they were found).
+	The random generator position is given by the seed, since the seed of each run is drawn
+	from its own stream (\see random_generator).
+
+	Snapshots are written to a temporary file which then replaces the previous one, so that
+	a checkpoint is never left half written.
+
+ */
+
+class Checkpoint {
+
+private:
+
+	string filename;
+	unsigned int interval; //seconds between two snapshots
+	double last_save;
+
+	//parameters identifying the run
+	uint32_t num_genes;
+	uint32_t num_conditions;
+	uint32_t runs;
+	uint32_t shard;
+	uint32_t shards;
+	uint32_t cells_per_run;
+	uint64_t seed;
+	float delta_reduce;
+	float delta_expand;
+	uint32_t drivers; //1 for gene driver, 2 for condition driver
+	uint64_t data_hash; //hash of the genes and conditions the run is restricted to, and of its warm seeds
+
+	vector<bool> done; //one flag for each cell of the grid
+
+public:
+
+/**
+	\brief  Return a checkpoint for a run.
+
+	\param filename checkpoint filepath
+	\param interval seconds between two snapshots
+	\param num_genes number of genes
+	\param num_conditions number of conditions
+	\param runs number of random initial seeds
+	\param cells_per_run number of threshold pairs evaluated for each seed
+	\param seed random seed
+	\param shard the shard
+	\param shards number of shards
+	\param delta_reduce reduction threshold (AID parameter)
+	\param delta_expand expansion threshold (AID parameter)
+	\param dd_row set if AID is performed on gene dimension
+	\param dd_col set if AID is performed on condition dimension
+	\param data_hash hash of the data the run depends on beyond its size (subsets, filtered genes, warm seeds)
+	\return the checkpoint
+*/
+
+	Checkpoint(const string& filename, unsigned int interval, unsigned int num_genes, unsigned int num_conditions, unsigned int runs, unsigned int cells_per_run, unsigned long seed, unsigned int shard, unsigned int shards, float delta_reduce, float delta_expand, bool dd_row, bool dd_col, uint64_t data_hash);
+
+/**
+	\brief Return whether a grid cell has already been evaluated
+
+	\param cell the cell
+	\return true if the cell has been evaluated, false otherwise
+*/
+	bool isDone(unsigned long cell);
+
+/**
+	\brief Mark a grid cell as evaluated
+
+	\param cell the cell
+*/
+	void setDone(unsigned long cell);
+
+/**
+	\brief Save a snapshot if interval seconds passed since the last one, or if termination was requested.
+
+	\param results the biclusters found so far
+	\param found_at the grid cell where each bicluster was found
+	\return false if the snapshot could not be written, true otherwise
+*/
+	bool update(vector<Bicluster>& results, vector<unsigned long>& found_at);
+
+/**
+	\brief Save a snapshot.
+
+	\param results the biclusters found so far
+	\param found_at the grid cell where each bicluster was found
+	\return false if the snapshot could not be written, true otherwise
+*/
+	bool save(vector<Bicluster>& results, vector<unsigned long>& found_at);
+
+/**
+	\brief Load the snapshot saved in the checkpoint file.
+
+	The snapshot must refer to a run with the same parameters.
+
+	\param results the biclusters found so far
+	\param found_at the grid cell where each bicluster was found
+	\return true on success, false if the file cannot be read or refers to another run
+*/
+	bool load(vector<Bicluster>& results, vector<unsigned long>& found_at);
+
+/**
+	\brief Read the random seed of the run saved in a checkpoint file, so that it can be resumed without giving it.
+
+	\param filename checkpoint filepath
+	\param seed the random seed
+	\return true on success, false if the file cannot be read or it is not a checkpoint
+*/
+	static bool readSeed(const string& filename, unsigned long& seed);
+
+/**
+	\brief Return the number of evaluated grid cells
+
+	\return number of evaluated cells
+*/
+	unsigned long doneNumber();
+
+/**
+	\brief Make SIGTERM and SIGINT request termination, rather than killing the process.
+*/
+	static void handleSignals();
+
+/**
+	\brief Return whether termination was requested by a signal
+
+	\return true if termination was requested, false otherwise
+*/
+	static bool terminationRequested();
+
+} ;
+
+#endif
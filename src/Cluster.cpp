@@ -19,9 +19,10 @@
 
 
 #include "Cluster.hpp"
+#include "Trace.hpp"
 
 	
-floatvect Cluster::getCluster()
+const floatvect& Cluster::getCluster() const
 {
 	return values;
 }
@@ -34,7 +35,7 @@ void Cluster::setValue(int i, float v)
 
 
 
-float Cluster::getValue(int i)
+float Cluster::getValue(int i) const
 {
 	return values[i];
 }
@@ -54,10 +55,10 @@ string Cluster::to_string()
 	return (output_index.str() + "\n" + output_values.str()); 
 }
 	
-bool Cluster::equal(Cluster c)
+bool Cluster::equal(const Cluster& c) const
 {
-	floatvect a = this->values;
-	floatvect b = c.values;
+	const floatvect& a = this->values;
+	const floatvect& b = c.values;
 	
 	bool result = true;
 	unsigned int i=0;
@@ -70,22 +71,23 @@ bool Cluster::equal(Cluster c)
 	return result;
 }	
 	
-Cluster Cluster::copy()
+intvect Cluster::getElements() const
 {
-	floatvect fv;
-	for (unsigned int i=0; i<this->values.size(); i++)
-		fv.push_back(this->values[i]);
-	
-	return Cluster(fv);
-}	
+	intvect iv;
+	getElements(iv);
+	return iv;
+}
 
-intvect Cluster::getElements()
+void Cluster::getElements(intvect& elements) const
 {
-	intvect iv;
+	elements.clear();
 	for (unsigned int i=0; i<this->values.size(); i++)
-		if (values[i] != 0.0) iv.push_back(i);	//element with 0 value does not belong to the cluster
-		
-	return iv;
+		if (values[i] != 0.0) elements.push_back(i);	//element with 0 value does not belong to the cluster
+}
+
+void Cluster::reset(unsigned int n)
+{
+	this->values.assign(n, 0.0);
 }
 	
 
@@ -96,26 +98,33 @@ intvect Cluster::getElements()
 
 void Cluster::filter(float threshold, unsigned int n)
 {
-	float avg = vect_mean(this->values);
-	float sigma = vect_std(this->values);
+	float* v = &this->values[0];
+	const long size = this->values.size();
+	const float d = n;
+	
+	double sum = 0.0;
+	double squares = 0.0;
+	#pragma omp simd reduction(+:sum,squares)
+	for (long i=0; i<size; i++)
+	{
+		v[i] /= d;
+		sum += v[i];
+		squares += (double) v[i]*v[i];
+	}
+	
+	float avg = sum/size;
+	float sigma = sqrt(max(0.0, (squares - sum*sum/size)/(size - 1)));
 	
 	if (sigma < 0.0001 && sigma > -0.0001) sigma = 1.0/sqrt(n); //random fluctuation
 	
 	threshold *= sigma;
 	
-	for (unsigned int i=0; i<this->values.size(); i++)
-		if (fabs(this->values[i] - avg) < threshold) this->values[i] = 0.0;
-		
-}
-
-
-void Cluster::average(unsigned int n)
-{	
-	for(unsigned int i=0; i<this->values.size(); i++)
-		this->values[i] /= n; 
+	#pragma omp simd
+	for (long i=0; i<size; i++)
+		v[i] = (fabsf(v[i] - avg) < threshold) ? 0.0f : v[i];
 }
 
-unsigned int Cluster::size()
+unsigned int Cluster::size() const
 {
 	int n = 0;
 	for(unsigned int i=0; i<this->values.size(); i++)
@@ -125,47 +134,41 @@ unsigned int Cluster::size()
 }
 
 
-Cluster Cluster::calculate(Matrix E, float threshold)
+Cluster Cluster::calculate(Matrix& E, float threshold)
 {
-	unsigned int n = this->size();
+	floatvect product = E.vector_product(this->values);
 	Cluster cluster;
-	cluster.values = E.vector_product(this->values);
-	cluster.average(n);
-	cluster.filter(threshold, n);
+	cluster.signature(product, this->size(), threshold);
 	return cluster;
 }
 
-void Cluster::setRandomSeed(int n) 
+void Cluster::signature(floatvect& product, unsigned int n, float threshold)
+{
+	this->values.swap(product);
+	this->filter(threshold, n);
+}
+
+void Cluster::setRandomSeed(int n, random_generator& rng) 
 {
-	intvect v;
-	intvect_it v_it;
-	
 	int max = this->values.size();
 	
+	//the score of all the elements of the random seed are inizialized to a uniform value
 	int i = 0;
 	while (i<n) 
 	{
-		int index = random_value(max);
-		v_it = find(v.begin(), v.end(), index); //check for n *different* values
-		if (v_it == v.end()) 
+		int index = rng.value(max);
+		if (values[index] == 0.0) //check for n *different* values
 		{
-			v.push_back(index);
+			values[index] = uniform_score;
 			i++;
 		}
 	}
-	
-	//the score of all the elements of the random seed are inizialized to a uniform value
-	for(unsigned int j=0; j<v.size(); j++)
-		values[v[j]] = uniform_score;
 }
 
 
-void Cluster::resetValues(intvect iv)
+void Cluster::resetValues(const intvect& iv)
 {
-	unsigned int n = this->values.size();
-	this->values.resize(0);
-	for(unsigned int i=0; i<n; i++)
-		this->values.push_back(0.0);
+	this->values.assign(this->values.size(), 0.0);
 	for(unsigned int i=0; i<iv.size(); i++)
 		this->values[iv[i]] = 1.0;
 }
@@ -176,38 +179,44 @@ void Cluster::resetValues(intvect iv)
 //====================================================================
 
 
-float Cluster::compute_averange_distance(intvect index, Driver driver)
+//position of the pair (a, b), with a < b, among the n*(n - 1)/2 pairs returned by Driver::gather
+static inline size_t pair_position(size_t a, size_t b, size_t n)
+{
+	return a*n - a*(a + 1)/2 + (b - a - 1);
+}
+
+
+float Cluster::compute_averange_distance(const floatvect& pairs)
 {
-	unsigned int n = index.size();
 	int count = 0; 
 	
 	float sum = 0.0;
-	for(unsigned int i=0; i<n-1; i++)
-		for(unsigned int j=i+1; j<n; j++) //it computes the distance between each object excluded itself and the driver is triangular
+	for(size_t p=0; p<pairs.size(); p++) //it computes the distance between each object excluded itself and the driver is triangular
+	{
+		float value = pairs[p];
+		if (value != -1)	//if no information was available, this distance is not considered
 		{
-			float value = driver.getElement(index[i], index[j]);
-			if (value != -1)	//if no information was available, this distance is not considered
-			{
-				count ++;
-				sum += value;
-			}
-		}	
+			count ++;
+			sum += value;
+		}
+	}	
 		
 	return sum/count;	
 }
 
 
-int Cluster::selectCentroid(intvect index, Driver driver)
+int Cluster::selectCentroid(unsigned int n, const floatvect& pairs)
 {
 	int min_distance = numeric_limits<int>::max();
 	int centroid = -1;
 	
-	for (unsigned int i=0; i<index.size(); i++)
+	for (unsigned int i=0; i<n; i++)
 	{	
 		float sum = 0.0;
-		for(unsigned int j=0; j<index.size(); j++)
+		for(unsigned int j=0; j<n; j++) //the distance of an object from itself is not among the pairs, and it is zero
 		{
-			float value = driver.getElement(index[i], index[j]);
+			if (j == i) continue;
+			float value = pairs[(j < i) ? pair_position(j, i, n) : pair_position(i, j, n)];
 			if (value != -1)
 				sum += value; //if no information was available, this distance is not considered
 		}
@@ -215,7 +224,7 @@ int Cluster::selectCentroid(intvect index, Driver driver)
 		if (sum < min_distance) 
 		{
 			min_distance = sum;
-			centroid = index[i];
+			centroid = i;
 		}
 	}
 	
@@ -223,55 +232,85 @@ int Cluster::selectCentroid(intvect index, Driver driver)
 }
 
 
-void Cluster::reduce(Driver driver, float reduce_coefficient)
+void Cluster::reduce(Driver& driver, float reduce_coefficient, ClusterWorkspace& workspace)
 {
 	//it retains only the objects with a distance wrt the cluster centroid 
 	//smaller or equal than the averange distance within all the cluster objects
 	
-	intvect index = this->getElements();
+	intvect& index = workspace.elements;
+	this->getElements(index);
 	
 	if (index.size() < 2) return; //reduction is useless
 	
-	float thresold = compute_averange_distance(index, driver);
-	int centroid = selectCentroid(index, driver);
+	//the distances within the cluster are read in a single batch
+	const unsigned int n = index.size();
+	floatvect& pairs = workspace.pairs;
+	driver.gather(index, pairs, workspace.driver);
+	
+	float thresold = compute_averange_distance(pairs);
+	int centroid = selectCentroid(n, pairs);
 	if (centroid == -1) return;
 	
-	intvect to_retain;
+	intvect& to_retain = workspace.retained;
+	to_retain.clear();
 	
-	to_retain.push_back(centroid);
-	for(unsigned int i=0; i<index.size(); i++) //it checks only the objects belonging to the cluster
-		if (driver.getElement(index[i], centroid) <= (thresold*reduce_coefficient)) to_retain.push_back(index[i]); //if no information is available, the distance is set to be -1, then the object is retained 'by default'
+	to_retain.push_back(index[centroid]);
+	for(unsigned int i=0; i<n; i++) //it checks only the objects belonging to the cluster
+	{
+		if ((int) i == centroid) continue; //already retained
+		float value = pairs[((int) i < centroid) ? pair_position(i, centroid, n) : pair_position(centroid, i, n)];
+		if (value <= (thresold*reduce_coefficient)) to_retain.push_back(index[i]); //if no information is available, the distance is set to be -1, then the object is retained 'by default'
+	}
 	
 	this->resetValues(to_retain);
 }
 
-void Cluster::expand(Driver driver, float expand_coefficient)
+void Cluster::expand(Driver& driver, float expand_coefficient, ClusterWorkspace& workspace)
 {
 	//it joins only the objects with a distance wrt the cluster centroid 
 	//smaller or equal than the averange distance within all the cluster objects
 	
-	intvect index = this->getElements();
+	intvect& index = workspace.elements;
+	this->getElements(index);
 	
 	if (index.size() == 0) return;
-	float thresold = compute_averange_distance(index, driver);
+	floatvect& pairs = workspace.pairs;
+	driver.gather(index, pairs, workspace.driver);
+	float thresold = compute_averange_distance(pairs);
 	if (thresold < 0.0001 && thresold > -0.0001) return; //no information available for this cluster
 	
-	int centroid = selectCentroid(index, driver);
-	if (centroid == -1) return;
+	int position = selectCentroid(index.size(), pairs);
+	if (position == -1) return;
+	int centroid = index[position];
+	
+	intvect& to_retain = workspace.retained;
+	to_retain.clear();
+	
+	if (driver.hasIndex()) //only the objects found through the index are evaluated
+	{
+		driver.expansion(centroid, thresold*expand_coefficient, index, to_retain);
+		this->resetValues(to_retain);
+		return;
+	}
+	
+	floatvect& distances = workspace.distances; //distances from the centroid, evaluated in a single batch
+	driver.distancesTo(centroid, distances, workspace.driver);
 	
-	intvect to_retain;
+	unsigned int member = 0; //next cluster object, since both the objects and the cluster are sorted
 	for(unsigned int d=0; d<driver.getRowsNumber(); d++) //it checks all the objects belonging to the data set
 	{
-		if (include(index, d)) to_retain.push_back(d); //it belongs already to the cluster
-		else if (driver.getElement(d, centroid) <= (thresold*expand_coefficient) && driver.getElement(d, centroid) >= 0) to_retain.push_back(d); //if no information is available, the distance is set to be -1, and the object MUST NOT be added (if the second check is not performed, it'll added 'by default')
+		while (member < index.size() && (unsigned int) index[member] < d) member++;
+		if (member < index.size() && (unsigned int) index[member] == d) to_retain.push_back(d); //it belongs already to the cluster
+		else if (distances[d] <= (thresold*expand_coefficient) && distances[d] >= 0) to_retain.push_back(d); //if no information is available, the distance is set to be -1, and the object MUST NOT be added (if the second check is not performed, it'll added 'by default')
 	}
 	
 	this->resetValues(to_retain);
 }
 
-void Cluster::drive(Driver driver, float reduce_coefficient, float expand_coefficient)
+void Cluster::drive(Driver& driver, float reduce_coefficient, float expand_coefficient, ClusterWorkspace& workspace)
 {
-	this->reduce(driver, reduce_coefficient);
-	this->expand(driver, expand_coefficient);
+	Trace::Scope scope("AID", "isa");
+	this->reduce(driver, reduce_coefficient, workspace);
+	this->expand(driver, expand_coefficient, workspace);
 }
 
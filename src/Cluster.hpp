@@ -42,6 +42,23 @@ using namespace std;
 
 
 
+/**
+	\brief Buffers of the data driven activities (\see Cluster::drive).
+	
+	Once grown to the size of the clusters, they are reused by every reduction and expansion, which then do not allocate.
+*/
+
+struct ClusterWorkspace
+{
+	intvect elements; //objects of the cluster
+	intvect retained; //objects of the reduced or expanded cluster
+	floatvect distances; //distances from the centroid
+	floatvect pairs; //distances between the objects of the cluster (\see Driver::gather)
+	DriverWorkspace driver; //buffers of the driver, if it is a view
+};
+
+
+
 /**
 	\brief Cluster class. 
 	
@@ -57,43 +74,38 @@ private:
 	floatvect values;
 
 /**
-	\brief Return objects (genes/conditions) that pass a statistical test.
+	\brief Return the mean of objects (genes/conditions) in a cluster signature that pass a statistical test.
 	Objects having a value far from the mean more than threshold times the standar deviation are retained.
 	
 	If eveluated standard deviation is zero, standard deviation expected for random fluctuation is used.
 	
+	Averaging and filtering are fused in two vectorised passes: the first one averages the values and 
+	accumulates their sum and sum of squares (in double precision), the second one thresholds them.
+	
 	\param threshold distance in standard deviations
 	\param n cluster signature size
 */
 
 	void filter(float threshold, unsigned int n);	
 
-/** 
-	\brief  Return the mean of objects (genes/conditions) in a cluster signature
-	
-	\param n cluster signature size
-*/
-
-	void average(unsigned int n);
-
 
 /**
 	\brief Return the average object distance
 	
-	\param index cluster
-	\param driver distance matrix
+	\param pairs distances between the cluster objects, as returned by Driver::gather
 */
-	static float compute_averange_distance(intvect index, Driver driver);
+	static float compute_averange_distance(const floatvect& pairs);
 
 /**
 	\brief Return the cluster centroid.
 	
 	A cluster centroid is the object more similar to all the other objects belonging to the cluster, i.e., the one closest (minimun distance), to all the other objects belonging to the cluster
 	
-	\param index cluster
-	\param driver distance matrix
+	\param n number of cluster objects
+	\param pairs distances between the cluster objects, as returned by Driver::gather
+	\return the position of the centroid among the cluster objects, -1 if there is none
 */	
-	static int selectCentroid(intvect index, Driver driver); 
+	static int selectCentroid(unsigned int n, const floatvect& pairs); 
 
 
 /**
@@ -103,18 +115,21 @@ private:
 	
 	\param driver distance matrix
 	\param reduce_coefficient reduction threshold
+	\param workspace buffers to reuse
 */	
-	void reduce(Driver driver, float reduce_coefficient); 
+	void reduce(Driver& driver, float reduce_coefficient, ClusterWorkspace& workspace); 
 	
 /**
 	\brief Return the expanded cluster
 	
 	It adds objects having a distance wrt the cluster centroid smaller or equal than expand_threshold times the averange distance within all the cluster objects.
+	If the driver has an index, only the objects it retrieves are evaluated (\see Driver::buildIndex).
 	
 	\param driver distance matrix
 	\param expand_coefficient expansion threshold
+	\param workspace buffers to reuse
 */	
-	void expand(Driver driver, float expand_coefficient); 
+	void expand(Driver& driver, float expand_coefficient, ClusterWorkspace& workspace); 
 	
 /**
 	\brief Return a cluster where the values of indices in iv are set to 1.0, whilist other values are set to 0.0. 
@@ -122,7 +137,7 @@ private:
 	\param iv the index to set to 1.0
 */	
 
-	void resetValues(intvect iv);
+	void resetValues(const intvect& iv);
 
 public:
 
@@ -160,6 +175,17 @@ public:
 		values = fv;
 	};
 
+/**
+	\brief Copy and move.
+	
+	A copy assigned to a cluster of the same size reuses its entries, and a move takes them over.
+*/
+
+	Cluster(const Cluster& c) = default;
+	Cluster(Cluster&& c) = default;
+	Cluster& operator=(const Cluster& c) = default;
+	Cluster& operator=(Cluster&& c) = default;
+
 /**
 	\brief Destructor.
 */
@@ -175,7 +201,7 @@ public:
 */
 
 	
-	floatvect getCluster();
+	const floatvect& getCluster() const;
 
 	
 /**
@@ -194,14 +220,21 @@ public:
 	\param i object index
 	\return object value
 */		
-	float getValue(int i);
+	float getValue(int i) const;
 
 /**
 	\brief Return cluster objects (indices)
 	
 	\return cluster objects
 */
-	intvect getElements();
+	intvect getElements() const;
+
+/**
+	\brief Set elements to the cluster objects (indices), reusing its entries
+	
+	\param elements the cluster objects
+*/
+	void getElements(intvect& elements) const;
 
 /**
 	\brief Return the cluster size.
@@ -209,7 +242,14 @@ public:
 	
 	\return cluster size
 */	
-	unsigned int size();
+	unsigned int size() const;
+
+/**
+	\brief Set the cluster to n objects, none of which belongs to it.
+	
+	\param n number of objects
+*/
+	void reset(unsigned int n);
 
 
 /**
@@ -231,14 +271,7 @@ public:
 */ 
 
   	
-	bool equal(Cluster c);
-	
-/**
-	\brief Return a copy of the cluster
-	
-	\return a copy of the cluster
-*/
-	Cluster copy();
+	bool equal(const Cluster& c) const;
 	
 	
 
@@ -255,15 +288,32 @@ public:
 	\return cluster signature
 */
 
-	Cluster calculate(Matrix E, float threshold); 
+	Cluster calculate(Matrix& E, float threshold); 
+
+/**
+	\brief Set the cluster to the signature, given the product between the data matrix and a cluster of n objects.
+	
+	The cluster takes over the product buffer, which is given back the previous entries of the cluster, so that 
+	both buffers are reused by the next product.
+	
+	\see calculate
+	
+	\param product the matrix-cluster product
+	\param n number of objects belonging to the multiplied cluster
+	\param threshold objects threshold
+*/
+
+	void signature(floatvect& product, unsigned int n, float threshold); 
 
 /**
 	\brief Return the initial seed according to the SA algorithm [Ihmels et al., Nat Genet, 2002].
+	The cluster must have no objects yet (\see reset).
 	
 	\param n number of objects belonging to the cluster
+	\param rng the random generator
 */
 
-	void setRandomSeed(int n);
+	void setRandomSeed(int n, random_generator& rng);
 
 	
 
@@ -277,9 +327,10 @@ public:
 	\param driver distance matrix
 	\param reduce_coefficient reduction threshold
 	\param expand_coefficient expansion threshold
+	\param workspace buffers to reuse
 */
 
-	void drive(Driver driver, float reduce_coefficient, float expand_coefficient);
+	void drive(Driver& driver, float reduce_coefficient, float expand_coefficient, ClusterWorkspace& workspace);
 
 } ;
 
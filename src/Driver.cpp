@@ -20,6 +20,352 @@
 
 #include "Driver.hpp"
 
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+//------------------------------ annotations -------------------------------
+
+struct annotation_entries
+{
+	unsigned int objects;
+	vector<uint64_t> begin; //bitset words of object i are in [begin[i], begin[i+1])...
+	vector<uint32_t> word_index; //...stored as the index of nonzero words...
+	vector<uint64_t> word_bits; //...and their bits
+	vector<uint32_t> terms; //number of terms of each object
+	
+	//rows cache, the most recently used row first
+	size_t capacity;
+	placed_floatvect cache;
+	list<unsigned int> recent;
+	unordered_map<unsigned int, pair<list<unsigned int>::iterator, size_t> > cached; //row -> (position in recent, slot)
+	mutex lock;
+	
+	float distance(unsigned int i, unsigned int j)
+	{
+		if (terms[i] == 0 || terms[j] == 0) return -1; //no information available
+		
+		//words are sorted by index, so that the intersection is a merge
+		uint64_t a = begin[i], b = begin[j];
+		uint32_t shared = 0;
+		while (a < begin[i + 1] && b < begin[j + 1])
+		{
+			if (word_index[a] < word_index[b]) a++;
+			else if (word_index[a] > word_index[b]) b++;
+			else shared += __builtin_popcountll(word_bits[a++] & word_bits[b++]);
+		}
+		return 1.0 - (float) shared/(terms[i] + terms[j] - shared);
+	}
+	
+	const float* row(unsigned int j)
+	{
+		unordered_map<unsigned int, pair<list<unsigned int>::iterator, size_t> >::iterator it = cached.find(j);
+		if (it != cached.end())
+		{
+			recent.splice(recent.begin(), recent, it->second.first);
+			return &cache[it->second.second*objects];
+		}
+		
+		size_t slot = cached.size();
+		if (cached.size() == capacity) //the least recently used row is evicted
+		{
+			slot = cached[recent.back()].second;
+			cached.erase(recent.back());
+			recent.pop_back();
+		}
+		recent.push_front(j);
+		cached[j] = make_pair(recent.begin(), slot);
+		
+		float* r = &cache[slot*objects];
+		const long n = objects;
+		#pragma omp parallel for schedule(static)
+		for (long k=0; k<n; k++)
+			r[k] = distance(k, j);
+		return r;
+	}
+	
+	float get(unsigned int i, unsigned int j)
+	{
+		if (capacity == 0) return distance(i, j);
+		
+		lock_guard<mutex> guard(lock);
+		unordered_map<unsigned int, pair<list<unsigned int>::iterator, size_t> >::iterator it = cached.find(i);
+		if (it != cached.end()) return cache[it->second.second*objects + j];
+		return row(j)[i];
+	}
+	
+	void column(unsigned int j, floatvect& distances)
+	{
+		if (capacity == 0)
+		{
+			for (unsigned int i=0; i<objects; i++) distances[i] = distance(i, j);
+			return;
+		}
+		
+		lock_guard<mutex> guard(lock);
+		const float* r = row(j);
+		copy(r, r + objects, distances.begin());
+	}
+	
+	//distances of the pairs (index[a], index[b]) with a < b, read under a single lock: each pair is taken from the 
+	//row of its first object already cached, or else from the row of its second object, which is cached
+	void pairs(const intvect& index, floatvect& distances)
+	{
+		const size_t n = index.size();
+		size_t p = 0;
+		if (capacity == 0)
+		{
+			for (size_t a=0; a<n; a++)
+				for (size_t b=a+1; b<n; b++)
+					distances[p++] = distance(index[a], index[b]);
+			return;
+		}
+		
+		lock_guard<mutex> guard(lock);
+		for (size_t a=0; a<n; a++)
+		{
+			unordered_map<unsigned int, pair<list<unsigned int>::iterator, size_t> >::iterator it = cached.find(index[a]);
+			if (it != cached.end())
+			{
+				const float* r = &cache[it->second.second*objects];
+				for (size_t b=a+1; b<n; b++) distances[p++] = r[index[b]];
+			}
+			else
+				for (size_t b=a+1; b<n; b++) distances[p++] = row(index[b])[index[a]];
+		}
+	}
+};
+
+//------------------------------ embeddings --------------------------------
+
+struct embedding_entries
+{
+	unsigned int objects;
+	unsigned int features;
+	metric_t metric;
+	placed_floatvect values; //row-major embeddings
+	floatvect inverse_norm; //for the cosine metric
+	vector<bool> known; //false if no embedding is available
+	
+	//the same kernel serves single distances and distances to a centroid, so that they agree
+	float distance(unsigned int i, unsigned int j)
+	{
+		if (!known[i] || !known[j]) return -1; //no information available
+		
+		const float* a = &values[(size_t)i*features];
+		const float* b = &values[(size_t)j*features];
+		const int d = features;
+		float sum = 0.0;
+		if (metric == metric_cosine)
+		{
+			#pragma omp simd reduction(+:sum)
+			for (int k=0; k<d; k++)
+				sum += a[k]*b[k];
+			return max(0.0f, 1.0f - sum*inverse_norm[i]*inverse_norm[j]);
+		}
+		
+		#pragma omp simd reduction(+:sum)
+		for (int k=0; k<d; k++)
+			sum += (a[k] - b[k])*(a[k] - b[k]);
+		return sqrt(sum);
+	}
+};
+
+//------------------------------ index -------------------------------------
+
+//banded locality sensitive hashing: objects colliding with the query in at least one band are candidates
+struct lsh_index
+{
+	enum family_t { minhash, simhash, pstable }; //Jaccard, cosine and euclidean distances
+	
+	family_t family;
+	unsigned int objects;
+	unsigned int bands; //bands stored...
+	unsigned int rows; //...of rows hash values each
+	float recall; //target probability of retrieving an object within the radius
+	float width; //bucket width of the p-stable projections
+	vector<char> indexed; //false if no information is available
+	vector<uint32_t> keys; //band keys of object i are in [i*bands, (i+1)*bands)
+	vector< vector< pair<uint32_t, uint32_t> > > tables; //(key, object) of each band, sorted by key
+	
+	//comparison with the exact expansion
+	bool validate;
+	mutex lock;
+	unsigned long expansions;
+	unsigned long evaluated;
+	unsigned long exact_objects;
+	unsigned long missed_objects;
+	unsigned long differing;
+	
+	lsh_index() : family(minhash), objects(0), bands(0), rows(0), recall(0), width(0), validate(false), 
+	              expansions(0), evaluated(0), exact_objects(0), missed_objects(0), differing(0) {};
+	
+	static uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+	
+	static double gaussian(random_generator& rng)
+	{
+		double u = ((rng.next() >> 11) + 1.0)/9007199254740993.0; //in (0, 1]
+		double v = (rng.next() >> 11)/9007199254740992.0;
+		return sqrt(-2.0*log(u))*cos(2.0*M_PI*v);
+	}
+	
+	//probability that an object at the given distance agrees with the query on a single hash value
+	double probability(float distance)
+	{
+		if (distance <= 0) return 1.0;
+		if (family == minhash) return max(0.0, 1.0 - distance);
+		if (family == simhash) return 1.0 - acos(max(-1.0, 1.0 - distance))/M_PI;
+		
+		double t = width/distance;
+		return 1.0 - erfc(t/sqrt(2.0)) - 2.0/(sqrt(2.0*M_PI)*t)*(1.0 - exp(-t*t/2.0));
+	}
+	
+	//the fewest bands retrieving an object at the radius with the target probability
+	unsigned int bandsFor(float radius)
+	{
+		double p = pow(probability(radius), (double) rows);
+		if (p >= 1.0) return 1;
+		if (p <= 0.0) return bands;
+		double needed = ceil(log(1.0 - recall)/log(1.0 - p));
+		return (unsigned int) max(1.0, min((double) bands, needed));
+	}
+	
+	void sort_tables()
+	{
+		tables.assign(bands, vector< pair<uint32_t, uint32_t> >());
+		const long b_max = bands;
+		#pragma omp parallel for schedule(static)
+		for (long b=0; b<b_max; b++)
+		{
+			for (unsigned int i=0; i<objects; i++)
+				if (indexed[i]) tables[b].push_back(make_pair(keys[(size_t)i*bands + b], i));
+			sort(tables[b].begin(), tables[b].end());
+		}
+	}
+	
+	//the objects colliding with object j in the first n bands, sorted
+	void candidates(unsigned int j, unsigned int n, intvect& objects)
+	{
+		objects.clear();
+		if (!indexed[j]) return;
+		for (unsigned int b=0; b<n; b++)
+		{
+			vector< pair<uint32_t, uint32_t> >::iterator it = lower_bound(tables[b].begin(), tables[b].end(), make_pair(keys[(size_t)j*bands + b], (uint32_t) 0));
+			for (; it != tables[b].end() && it->first == keys[(size_t)j*bands + b]; it++)
+				objects.push_back(it->second);
+		}
+		sort(objects.begin(), objects.end());
+		objects.erase(unique(objects.begin(), objects.end()), objects.end());
+	}
+	
+	void record(unsigned long candidates_number, unsigned long exact_number, unsigned long missed_number)
+	{
+		lock_guard<mutex> guard(lock);
+		expansions++;
+		evaluated += candidates_number;
+		exact_objects += exact_number;
+		missed_objects += missed_number;
+		if (missed_number > 0) differing++;
+	}
+	
+	void build(annotation_entries& a)
+	{
+		family = minhash;
+		objects = a.objects;
+		rows = 4;
+		bands = 32;
+		indexed.assign(objects, false);
+		keys.assign((size_t)objects*bands, 0);
+		
+		const long n = objects;
+		#pragma omp parallel for schedule(dynamic,256)
+		for (long i=0; i<n; i++)
+		{
+			if (a.terms[i] == 0) continue;
+			indexed[i] = true;
+			for (unsigned int b=0; b<bands; b++)
+			{
+				uint64_t key = b;
+				for (unsigned int r=0; r<rows; r++)
+				{
+					//minimum of the hash function b*rows+r over the terms of object i
+					uint64_t salt = mix((b*rows + r + 1)*0x9e3779b97f4a7c15ULL);
+					uint64_t smallest = UINT64_MAX;
+					for (uint64_t w=a.begin[i]; w<a.begin[i + 1]; w++)
+						for (uint64_t bits=a.word_bits[w]; bits; bits &= bits - 1)
+							smallest = min(smallest, mix(salt ^ ((uint64_t) a.word_index[w]*64 + __builtin_ctzll(bits))));
+					key = mix(key ^ smallest);
+				}
+				keys[(size_t)i*bands + b] = key;
+			}
+		}
+		sort_tables();
+	}
+	
+	void build(embedding_entries& e)
+	{
+		family = (e.metric == metric_cosine) ? simhash : pstable;
+		objects = e.objects;
+		rows = (family == simhash) ? 8 : 4;
+		bands = 32;
+		indexed.assign(e.known.begin(), e.known.end());
+		keys.assign((size_t)objects*bands, 0);
+		
+		//random projections, drawn from a fixed stream so that the index does not depend on the job
+		random_generator rng(0x5eed, 0);
+		const unsigned int d = e.features;
+		floatvect planes((size_t)bands*rows*d);
+		floatvect offsets((size_t)bands*rows);
+		for (size_t k=0; k<planes.size(); k++) planes[k] = gaussian(rng);
+		
+		if (family == pstable)
+		{
+			//the bucket width is the average distance between objects, estimated on a sample of pairs
+			double sum = 0.0;
+			unsigned int count = 0;
+			for (unsigned int k=0; k<1000; k++)
+			{
+				float value = e.distance(rng.value(objects), rng.value(objects));
+				if (value > 0) { sum += value; count++; }
+			}
+			width = (count > 0) ? sum/count : 1.0;
+			for (size_t k=0; k<offsets.size(); k++) offsets[k] = width*(rng.next() >> 11)/9007199254740992.0;
+		}
+		
+		const long n = objects;
+		#pragma omp parallel for schedule(static)
+		for (long i=0; i<n; i++)
+		{
+			if (!indexed[i]) continue;
+			const float* v = &e.values[(size_t)i*d];
+			for (unsigned int b=0; b<bands; b++)
+			{
+				uint64_t key = b;
+				for (unsigned int r=0; r<rows; r++)
+				{
+					const float* plane = &planes[((size_t)b*rows + r)*d];
+					float dot = 0.0;
+					#pragma omp simd reduction(+:dot)
+					for (unsigned int k=0; k<d; k++)
+						dot += plane[k]*v[k];
+					int64_t value = (family == simhash) ? (dot >= 0) : (int64_t) floor((dot + offsets[b*rows + r])/width);
+					key = mix(key ^ (uint64_t) value);
+				}
+				keys[(size_t)i*bands + b] = key;
+			}
+		}
+		sort_tables();
+	}
+};
+
+//---------------------------------------------------------------------------
+
 floatvect Driver::readFloatRow(string row) 
 {
   floatvect retval;
@@ -29,13 +375,37 @@ floatvect Driver::readFloatRow(string row)
   return retval;
 }
 
-floatmatrix Driver::readFloatVector(istream &is) 
+stringvect Driver::readStringRow(string row) 
+{
+  stringvect retval;
+  istringstream is(row);
+  string s;
+  while (is >> s) retval.push_back(s);
+  return retval;
+}
+
+void Driver::readFloatVector(istream &is) 
 {
   string line;
-  floatmatrix retval;
+  m.clear();
+  rows = 0;
+  cols = 0;
   while (getline(is, line))
-    retval.push_back(readFloatRow(line));
-  return retval;
+  {
+    floatvect row = readFloatRow(line);
+    if (row.empty()) continue; //blank lines carry no row
+    if (rows == 0) cols = row.size();
+    if (row.size() != cols)
+    {
+      //a ragged row would shift every following value, so the whole file is rejected
+      m.clear();
+      rows = 0;
+      cols = 0;
+      return;
+    }
+    m.insert(m.end(), row.begin(), row.end());
+    rows++;
+  }
 }
 
 
@@ -46,39 +416,453 @@ void Driver::loadFromFile(char* filename)
 	istream is(&fb);
 	if (!is) return;
 	
-	m = readFloatVector(is);
+	readFloatVector(is);
 		
 	fb.close();
 	return;
 }
 
 
+void Driver::loadAnnotationsFromFile(char* filename, size_t cache_bytes) 
+{
+	ifstream is(filename);
+	if (!is) return;
+	
+	//terms are numbered in order of appearance
+	shared_ptr<annotation_entries> a(new annotation_entries());
+	map<string, uint32_t> term_ids;
+	vector< vector<uint32_t> > sets;
+	string line;
+	while (getline(is, line))
+	{
+		stringvect names = readStringRow(line);
+		vector<uint32_t> set;
+		for (unsigned int k=0; k<names.size(); k++)
+		{
+			map<string, uint32_t>::iterator it = term_ids.insert(make_pair(names[k], (uint32_t) term_ids.size())).first;
+			set.push_back(it->second);
+		}
+		sort(set.begin(), set.end());
+		set.erase(unique(set.begin(), set.end()), set.end());
+		sets.push_back(set);
+	}
+	if (sets.empty()) return;
+	
+	//each set becomes the list of its nonzero bitset words
+	a->objects = sets.size();
+	a->begin.push_back(0);
+	for (unsigned int i=0; i<sets.size(); i++)
+	{
+		for (unsigned int k=0; k<sets[i].size(); k++)
+		{
+			uint32_t word = sets[i][k]/64;
+			if (a->word_index.size() == a->begin[i] || a->word_index.back() != word)
+			{
+				a->word_index.push_back(word);
+				a->word_bits.push_back(0);
+			}
+			a->word_bits.back() |= (uint64_t) 1 << (sets[i][k] % 64);
+		}
+		a->begin.push_back(a->word_index.size());
+		a->terms.push_back(sets[i].size());
+	}
+	
+	a->capacity = min((size_t) a->objects, cache_bytes/(a->objects*sizeof(float)));
+	a->cache.resize(a->capacity*a->objects);
+	
+	placed_floatvect().swap(m);
+	embeddings.reset();
+	annotations = a;
+	index.reset();
+	rows = a->objects;
+	cols = a->objects;
+}
+
+
+void Driver::loadEmbeddingsFromFile(char* filename, metric_t metric) 
+{
+	ifstream is(filename);
+	if (!is) return;
+	
+	shared_ptr<embedding_entries> e(new embedding_entries());
+	e->objects = 0;
+	e->features = 0;
+	e->metric = metric;
+	
+	string line;
+	vector<floatvect> lines;
+	while (getline(is, line))
+	{
+		lines.push_back(readFloatRow(line));
+		if (e->features == 0) e->features = lines.back().size();
+	}
+	if (lines.empty() || e->features == 0) return;
+	
+	e->objects = lines.size();
+	e->values.assign((size_t)e->objects*e->features, 0.0);
+	e->inverse_norm.assign(e->objects, 0.0);
+	e->known.assign(e->objects, false);
+	for (unsigned int i=0; i<e->objects; i++)
+	{
+		if (lines[i].size() != e->features) continue;
+		copy(lines[i].begin(), lines[i].end(), e->values.begin() + (size_t)i*e->features);
+		
+		double norm = 0.0;
+		for (unsigned int k=0; k<e->features; k++) norm += lines[i][k]*lines[i][k];
+		e->known[i] = (metric != metric_cosine || norm > 0.0);
+		e->inverse_norm[i] = (norm > 0.0) ? 1.0/sqrt(norm) : 0.0;
+	}
+	
+	placed_floatvect().swap(m);
+	annotations.reset();
+	embeddings = e;
+	index.reset();
+	rows = e->objects;
+	cols = e->objects;
+}
+
+
+bool Driver::addSource(shared_ptr<Driver> source, float weight, float missing_distance)
+{
+	if (!sources.empty() && source->getRowsNumber() != rows) return false;
+	
+	sources.push_back(source);
+	weights.push_back(weight);
+	missing.push_back(missing_distance);
+	rows = source->getRowsNumber();
+	cols = source->getColumnsNumber();
+	return true;
+}
+
+
+bool Driver::weighSources(const floatvect& source_weights, const floatvect& missing_distances)
+{
+	if (source_weights.size() != sources.size() || missing_distances.size() != sources.size()) return false;
+	
+	weights = source_weights;
+	missing = missing_distances;
+	return true;
+}
+
+
+unsigned int Driver::getSourcesNumber()
+{
+	return sources.size();
+}
+
+
+float Driver::fusedElement(int i, int j)
+{
+	if (sources.size() == 1 && missing[0] < 0) return sources[0]->getElement(i, j);
+	
+	float sum = 0.0;
+	float total = 0.0;
+	for (unsigned int k=0; k<sources.size(); k++)
+	{
+		float value = sources[k]->getElement(i, j);
+		if (value == -1) //no information available from this source
+		{
+			if (missing[k] < 0) continue;
+			value = missing[k];
+		}
+		sum += weights[k]*value;
+		total += weights[k];
+	}
+	return (total > 0) ? sum/total : -1;
+}
+
+
+bool Driver::parseMetric(const string& s, metric_t& m)
+{
+	if (s == "euclidean") m = metric_euclidean;
+	else if (s == "cosine") m = metric_cosine;
+	else return false;
+	return true;
+}
+
+
 unsigned int Driver::getRowsNumber() 
 {
-	return m.size();
+	return rows;
 }
 	
 unsigned int Driver::getColumnsNumber() 
 {
-	return m[0].size();
+	return cols;
+}
+
+
+Driver Driver::view(const intvect& index)
+{
+	Driver v;
+	v.viewed = viewed ? viewed : this;
+	v.objects = index;
+	if (viewed)
+		for (unsigned int k=0; k<index.size(); k++) v.objects[k] = objects[index[k]];
+	v.rows = index.size();
+	v.cols = index.size();
+	
+	//expansions through the index are mapped back to the view, which needs objects to be distinct
+	v.positions.assign(v.viewed->rows, -1);
+	for (unsigned int k=0; k<index.size(); k++)
+	{
+		if (v.positions[v.objects[k]] >= 0)
+		{
+			v.positions.clear();
+			break;
+		}
+		v.positions[v.objects[k]] = k;
+	}
+	return v;
 }
 
 
 float Driver::getElement(int i, int j)
 {
-	return m[i][j];
+	if (viewed) return viewed->getElement(objects[i], objects[j]);
+	if (!sources.empty()) return fusedElement(i, j);
+	if (annotations) return annotations->get(i, j);
+	if (embeddings) return embeddings->distance(i, j);
+	return m[(size_t)i*cols + j];
+}
+
+
+void Driver::gather(const intvect& index, floatvect& distances)
+{
+	DriverWorkspace workspace;
+	gather(index, distances, workspace);
+}
+
+
+void Driver::gather(const intvect& index, floatvect& distances, DriverWorkspace& workspace)
+{
+	const size_t n = index.size();
+	distances.resize(n > 1 ? n*(n - 1)/2 : 0);
+	
+	if (viewed) //views are not nested, so that the viewed driver does not use the workspace
+	{
+		intvect& viewed_index = workspace.index;
+		viewed_index.resize(n);
+		for (size_t a=0; a<n; a++) viewed_index[a] = objects[index[a]];
+		viewed->gather(viewed_index, distances);
+		return;
+	}
+	
+	if (sources.size() == 1 && missing[0] < 0)
+	{
+		sources[0]->gather(index, distances);
+		return;
+	}
+	
+	if (!sources.empty())
+	{
+		floatvect sum(distances.size(), 0.0), total(distances.size(), 0.0), pairs;
+		for (unsigned int k=0; k<sources.size(); k++)
+		{
+			sources[k]->gather(index, pairs);
+			for (size_t p=0; p<pairs.size(); p++)
+			{
+				float value = pairs[p];
+				if (value == -1)
+				{
+					if (missing[k] < 0) continue;
+					value = missing[k];
+				}
+				sum[p] += weights[k]*value;
+				total[p] += weights[k];
+			}
+		}
+		for (size_t p=0; p<distances.size(); p++)
+			distances[p] = (total[p] > 0) ? sum[p]/total[p] : -1;
+		return;
+	}
+	
+	//annotation pairs are read in a single pass over the rows cache
+	if (annotations)
+	{
+		annotations->pairs(index, distances);
+		return;
+	}
+	
+	size_t p = 0;
+	for (size_t a=0; a<n; a++)
+		for (size_t b=a+1; b<n; b++)
+		{
+			if (embeddings) distances[p++] = embeddings->distance(index[a], index[b]);
+			else distances[p++] = m[(size_t)index[a]*cols + index[b]];
+		}
+}
+
+
+void Driver::distancesTo(int j, floatvect& distances)
+{
+	DriverWorkspace workspace;
+	distancesTo(j, distances, workspace);
+}
+
+
+void Driver::distancesTo(int j, floatvect& distances, DriverWorkspace& workspace)
+{
+	const long n = rows;
+	distances.resize(n);
+	
+	if (viewed) //views are not nested, so that the viewed driver does not use the workspace
+	{
+		floatvect& all = workspace.distances;
+		viewed->distancesTo(objects[j], all);
+		for (long i=0; i<n; i++) distances[i] = all[objects[i]];
+	}
+	else if (sources.size() == 1 && missing[0] < 0)
+	{
+		sources[0]->distancesTo(j, distances);
+	}
+	else if (!sources.empty())
+	{
+		//each source is read by its own batch path, and columns are averaged
+		floatvect sum(n, 0.0), total(n, 0.0), column;
+		for (unsigned int k=0; k<sources.size(); k++)
+		{
+			sources[k]->distancesTo(j, column);
+			for (long i=0; i<n; i++)
+			{
+				float value = column[i];
+				if (value == -1)
+				{
+					if (missing[k] < 0) continue;
+					value = missing[k];
+				}
+				sum[i] += weights[k]*value;
+				total[i] += weights[k];
+			}
+		}
+		for (long i=0; i<n; i++)
+			distances[i] = (total[i] > 0) ? sum[i]/total[i] : -1;
+	}
+	else if (embeddings)
+	{
+		#pragma omp parallel for schedule(static)
+		for (long i=0; i<n; i++)
+			distances[i] = embeddings->distance(i, j);
+	}
+	else if (annotations)
+	{
+		annotations->column(j, distances);
+	}
+	else
+	{
+		for (long i=0; i<n; i++)
+			distances[i] = m[(size_t)i*cols + j];
+	}
+}
+
+
+
+bool Driver::buildIndex(float recall, bool validate)
+{
+	if (viewed) return !positions.empty() && viewed->buildIndex(recall, validate);
+	if (sources.size() == 1 && missing[0] < 0) return sources[0]->buildIndex(recall, validate);
+	if (!annotations && !embeddings) return false;
+	
+	shared_ptr<lsh_index> l(new lsh_index());
+	if (annotations) l->build(*annotations);
+	else l->build(*embeddings);
+	l->recall = recall;
+	l->validate = validate;
+	index = l;
+	return true;
+}
+
+
+bool Driver::hasIndex()
+{
+	if (viewed) return !positions.empty() && viewed->hasIndex();
+	if (sources.size() == 1 && missing[0] < 0) return sources[0]->hasIndex();
+	return (bool) index;
 }
 
 
+void Driver::expansion(int j, float radius, const intvect& members, intvect& expanded)
+{
+	//a view expands on the viewed driver, and keeps the objects it views
+	if (viewed)
+	{
+		intvect viewed_members(members.size()), viewed_expanded;
+		for (unsigned int k=0; k<members.size(); k++) viewed_members[k] = objects[members[k]];
+		sort(viewed_members.begin(), viewed_members.end());
+		viewed->expansion(objects[j], radius, viewed_members, viewed_expanded);
+		
+		expanded.clear();
+		for (unsigned int k=0; k<viewed_expanded.size(); k++)
+			if (positions[viewed_expanded[k]] >= 0) expanded.push_back(positions[viewed_expanded[k]]);
+		sort(expanded.begin(), expanded.end());
+		return;
+	}
+	
+	if (sources.size() == 1 && missing[0] < 0) return sources[0]->expansion(j, radius, members, expanded);
+	
+	intvect candidates;
+	index->candidates(j, index->bandsFor(radius), candidates);
+	
+	//candidates are checked against their exact distance, so that the index only misses objects
+	const long n = candidates.size();
+	floatvect distances(n);
+	#pragma omp parallel for schedule(static)
+	for (long k=0; k<n; k++)
+		distances[k] = annotations ? annotations->distance(candidates[k], j) : embeddings->distance(candidates[k], j);
+	
+	intvect found;
+	for (long k=0; k<n; k++)
+		if (distances[k] <= radius && distances[k] >= 0) found.push_back(candidates[k]);
+	
+	//members and candidates are sorted
+	expanded.clear();
+	set_union(members.begin(), members.end(), found.begin(), found.end(), back_inserter(expanded));
+	
+	unsigned long exact_number = 0, missed_number = 0;
+	if (index->validate)
+	{
+		floatvect exact;
+		distancesTo(j, exact);
+		for (unsigned int i=0; i<rows; i++)
+			if (exact[i] <= radius && exact[i] >= 0 && !binary_search(members.begin(), members.end(), (int) i))
+			{
+				exact_number++;
+				if (!binary_search(found.begin(), found.end(), (int) i)) missed_number++;
+			}
+	}
+	index->record(n, exact_number, missed_number);
+}
+
+
+string Driver::indexReport()
+{
+	if (viewed) return hasIndex() ? viewed->indexReport() : "";
+	if (sources.size() == 1 && missing[0] < 0) return sources[0]->indexReport();
+	if (!index) return "";
+	
+	lock_guard<mutex> guard(index->lock);
+	ostringstream output;
+	unsigned long e = max(index->expansions, 1UL);
+	output << index->expansions << " expansions, " << (float) index->evaluated/e << " objects evaluated on average (" 
+	       << 100.0*index->evaluated/((double) e*rows) << "% of " << rows << ")";
+	if (index->validate)
+	{
+		output << "; " << index->exact_objects - index->missed_objects << " of the " << index->exact_objects << " objects added by the exact expansion were found (recall ";
+		output << ((index->exact_objects > 0) ? 1.0 - (double) index->missed_objects/index->exact_objects : 1.0) << "), ";
+		output << index->differing << " expanded clusters (" << 100.0*index->differing/e << "%) differ from the exact ones";
+	}
+	return output.str();
+}
+
 
 string Driver::to_string()
 {
 	ostringstream output;
-	for(unsigned int i=0; i<m.size(); i++)
+	for(unsigned int i=0; i<rows; i++)
 	{
-		for(unsigned int j=0; j<m[i].size(); j++) 
+		for(unsigned int j=0; j<cols; j++) 
 		{	
-			output << m[i][j];
+			output << getElement(i, j);
 			output << "\t";
 		}
 		output << "\n";
@@ -91,11 +875,9 @@ string Driver::to_string()
 void Driver::normalize()
 {
 	float max = FLT_MIN;
-	for(unsigned int i=0; i<m.size(); i++)
-		for(unsigned int j=0; j<m[i].size(); j++)
-			if (m[i][j] > max) max = m[i][j];
+	for(size_t k=0; k<m.size(); k++)
+		if (m[k] > max) max = m[k];
 	
-	for(unsigned int i=0; i<m.size(); i++)
-		for(unsigned int j=0; j<m[i].size(); j++)
-			m[i][j] = m[i][j]/max;
+	for(size_t k=0; k<m.size(); k++)
+		m[k] = m[k]/max;
 }
@@ -31,11 +31,58 @@
 #include <sstream>
 #include <string.h>
 #include <vector>
+#include <memory>
 #include "Matrix.hpp"
+#include "Memory.hpp"
 
 using namespace std;
 
 
+/**
+	\brief Annotation storage: the term set of each object, and a cache of distance rows.
+	
+	\see Driver::loadAnnotationsFromFile
+*/
+
+struct annotation_entries;
+
+
+/**
+	\brief Embedding storage: a feature vector for each object.
+	
+	\see Driver::loadEmbeddingsFromFile
+*/
+
+struct embedding_entries;
+
+
+/**
+	\brief Approximate nearest neighbour index of the objects of a driver.
+	
+	\see Driver::buildIndex
+*/
+
+struct lsh_index;
+
+/**
+	\brief Distance between embeddings.
+*/
+
+enum metric_t { metric_euclidean, metric_cosine };
+
+
+/**
+	\brief Buffers of the distances read through a view (\see Driver::distancesTo and Driver::gather).
+	
+	Once grown, they are reused by every read, which then does not allocate.
+*/
+
+struct DriverWorkspace
+{
+	intvect index; //objects of the viewed driver
+	floatvect distances; //distances read from the viewed driver
+};
+
 
 
 /**
@@ -43,6 +90,12 @@ using namespace std;
 	
 	Define a driver as a float matrix, where each row/column represent an object and cells represent distances.
 	A driver contains the additional information used by AID algorithm [Visconti et al., Intelligent Data Analysis, 2013].
+	Distances are stored row-major in a buffer placed by the Memory layer.
+	
+	Alternatively, distances are computed on demand from the annotations of the objects (\see loadAnnotationsFromFile)
+	or from their embeddings (\see loadEmbeddingsFromFile), so that no N x N matrix is needed.
+	A driver may also fuse several drivers of the same objects (\see addSource), evaluating their weighted 
+	average element by element. Finally, a driver can be a view of some objects of another one (\see view).
 	 
  */
 
@@ -50,9 +103,22 @@ class Driver {
 
 private:
 
-	floatmatrix m;
+	placed_floatvect m; //row-major distances
+	unsigned int rows;
+	unsigned int cols;
+	shared_ptr<annotation_entries> annotations; //annotations, if distances are computed on demand...
+	shared_ptr<embedding_entries> embeddings; //...or embeddings
+	shared_ptr<lsh_index> index; //approximate expansion, if required
+	vector< shared_ptr<Driver> > sources; //fused drivers, if any...
+	floatvect weights; //...their weights...
+	floatvect missing; //...and the distance replacing their -1 (negative if the source is skipped)
+	Driver* viewed; //the driver this is a view of, if any...
+	intvect objects; //...the objects of the view...
+	intvect positions; //...and the position of each object of that driver in the view (-1 if not viewed), empty if objects are repeated
+	
+	float fusedElement(int i, int j);
 	
-	static floatmatrix readFloatVector(istream &is);
+	void readFloatVector(istream &is);
 	static floatvect readFloatRow(string row);
 	
 	static stringvect readStringRow(string row);
@@ -75,7 +141,7 @@ public:
 	\return the driver
 */
 
-	Driver() {};
+	Driver() : rows(0), cols(0), viewed(NULL) {};
 
 /**
 	\brief  Return an initialized driver.
@@ -84,9 +150,11 @@ public:
 	\return the driver
 */	
 	
-	Driver(floatmatrix matrix)
+	Driver(floatmatrix& matrix) : rows(matrix.size()), cols(matrix.empty() ? 0 : matrix[0].size())
 	{
-		m = matrix;
+		m.reserve((size_t)rows*cols);
+		for (unsigned int i=0; i<rows; i++)
+			m.insert(m.end(), matrix[i].begin(), matrix[i].end());
 	}
 	
 /**
@@ -109,6 +177,18 @@ public:
 */	
 	unsigned int getColumnsNumber();
 	
+/**
+	\brief Return a view of some objects of this driver, which reads its distances in place.
+	
+	Object k of the view is object index[k] of this driver; objects can be repeated. A view of a view reads the 
+	driver viewed by the latter, so that views are never nested. The view is valid as long as that driver is not changed. Unless objects are repeated, the view shares the approximate index of this driver 
+	(\see buildIndex), whose expansions are restricted to the objects of the view; otherwise its expansions are exact.
+	
+	\param index the objects
+	\return the view
+*/
+	Driver view(const intvect& index);
+
 /**
 	\brief Return the value in position (i,j)
 	
@@ -120,6 +200,33 @@ public:
 	
 	float getElement(int i, int j);
 
+/**
+	\brief Return the distances between each object and object j, i.e. the column j of the driver
+	
+	Embedding distances are evaluated by a single parallel and vectorised pass over the embeddings.
+	
+	\param j the object index
+	\param distances the distances, one for each object
+	\param workspace the buffers of views
+*/	
+	
+	void distancesTo(int j, floatvect& distances, DriverWorkspace& workspace);
+	void distancesTo(int j, floatvect& distances);
+
+/**
+	\brief Return the distances between each pair of the given objects
+	
+	Only the pairs are read. Annotation distances are read under a single lock of the rows cache: each pair is taken 
+	from the row of one of its objects, which is cached if neither is.
+	
+	\param index the objects
+	\param distances the distances of the pairs (index[a], index[b]) with a < b, ordered by a and then by b
+	\param workspace the buffers of views
+*/	
+	
+	void gather(const intvect& index, floatvect& distances, DriverWorkspace& workspace);
+	void gather(const intvect& index, floatvect& distances);
+
 /**
 	\brief Return a driver saved in filename.
 
@@ -127,6 +234,117 @@ public:
 	\return the driver
 */	
 	void loadFromFile(char* filename); 
+
+/**
+	\brief Return a driver whose distances are computed on demand from the annotations saved in filename.
+	
+	Line i lists the annotation terms (e.g. GO terms) of object i, separated by blanks or tabs. The distance between 
+	two objects is the Jaccard distance between their term sets, evaluated by intersecting bitsets and counting 
+	their bits. Objects without annotations have distance -1 (no information available) from any object.
+	
+	Distance rows are kept in a cache of at most cache_bytes bytes, evicting the least recently used row. 
+	A distance is read from the cached row of either object (distances are symmetric); if neither is cached, 
+	the row of the second object is computed and cached, which is the access pattern of the AID steps 
+	(distances from the centroid, and between the objects of a cluster).
+	
+	\param filename filepath
+	\param cache_bytes size of the row cache
+*/	
+	void loadAnnotationsFromFile(char* filename, size_t cache_bytes); 
+
+/**
+	\brief Return a driver whose distances are computed on demand from the embeddings saved in filename.
+	
+	Line i lists the d features of object i. Objects whose line is empty, or has not d features, have distance -1 
+	(no information available) from any object, as well as objects with a null embedding under the cosine metric.
+	
+	\param filename filepath
+	\param metric euclidean distance or cosine distance (1 - cosine similarity)
+*/	
+	void loadEmbeddingsFromFile(char* filename, metric_t metric); 
+
+/**
+	\brief Build an approximate nearest neighbour index, used to expand clusters (\see expansion).
+	
+	Objects are hashed by banded locality sensitive hashing: MinHash for annotations, random hyperplanes for 
+	embeddings under the cosine metric and p-stable projections under the euclidean metric. The candidates of 
+	a query are the objects sharing a band key with it, and each query uses the fewest bands that retrieve an 
+	object at the query radius with probability recall. Only distance matrices given by annotations or 
+	embeddings are indexed, since a stored matrix already provides the distances at no cost. A view builds 
+	the index of the whole driver it views, unless its objects are repeated.
+	
+	\param recall target fraction of the objects within the radius retrieved by a query, in (0, 1)
+	\param validate set if each expansion is compared with the exact one (\see indexReport)
+	\return false if the driver cannot be indexed, true otherwise
+*/	
+	bool buildIndex(float recall, bool validate); 
+
+/**
+	\brief Return true if the driver has an index
+	
+	\return true if the driver has an index, false otherwise
+*/	
+	bool hasIndex(); 
+
+/**
+	\brief Return the members of a cluster, joined with the objects within radius from object j found through the index.
+	
+	The distance of each candidate is evaluated exactly, so that objects may be missed but none is added by mistake.
+	
+	\param j the object index (the cluster centroid)
+	\param radius the largest distance of an added object
+	\param members the sorted members of the cluster
+	\param expanded the sorted members of the expanded cluster
+*/	
+	void expansion(int j, float radius, const intvect& members, intvect& expanded); 
+
+/**
+	\brief Return a summary of the expansions performed through the index: the objects evaluated and, if 
+	validation was required, how the expanded clusters differ from the exact expansion
+	
+	\return the summary, empty if the driver has no index
+*/	
+	string indexReport(); 
+
+/**
+	\brief Add a source to the fused driver.
+	
+	The distance between two objects is the weighted average of their distances in each source. A source providing 
+	no information (-1) on a pair is either skipped, so that the remaining weights are averaged, or assumed to provide 
+	a given distance. If no source provides information, the distance is -1. Sources are evaluated lazily, so that 
+	the fused matrix is never stored; a driver with a single skipped source returns its distances unchanged.
+	
+	\param source the driver, with the same objects of the sources already added
+	\param weight the weight of the source
+	\param missing_distance the distance replacing -1, or a negative value if the source is skipped
+	\return false if the source has a different number of objects, true otherwise
+*/	
+	bool addSource(shared_ptr<Driver> source, float weight, float missing_distance); 
+
+/**
+	\brief Set the weight and the handling of missing distances of each source (\see addSource)
+	
+	\param source_weights the weight of each source
+	\param missing_distances the distance replacing -1 in each source, negative if the source is skipped
+	\return false if the number of sources differs, true otherwise
+*/	
+	bool weighSources(const floatvect& source_weights, const floatvect& missing_distances); 
+
+/**
+	\brief Return the number of fused sources
+	
+	\return number of sources
+*/	
+	unsigned int getSourcesNumber(); 
+
+/**
+	\brief Return the metric named s (euclidean or cosine)
+	
+	\param s the metric name
+	\param m the metric, set only if s is a valid name
+	\return true if s is a valid name, false otherwise
+*/	
+	static bool parseMetric(const string& s, metric_t& m); 
 	
 	
 /**
@@ -0,0 +1,1221 @@
+//      Engine.cpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#include "Engine.hpp"
+#include "Trace.hpp"
+
+#include <omp.h>
+#include <queue>
+
+
+bool Engine::loadData(const string& filename, bool out_of_core)
+{
+	if (out_of_core) E.mapFromFile(const_cast<char *>(filename.c_str()));
+	else E.loadFromFile(const_cast<char *>(filename.c_str()));
+	num_genes = E.getRowsNumber();
+	num_conditions = E.getColumnsNumber();
+	return num_genes > 0;
+}
+
+
+bool Engine::loadSparseData(const string& filename)
+{
+	E.loadSparseFromFile(const_cast<char *>(filename.c_str()));
+	num_genes = E.getRowsNumber();
+	num_conditions = E.getColumnsNumber();
+	return num_genes > 0;
+}
+
+
+bool Engine::loadGeneDriver(const string& filename)
+{
+	shared_ptr<Driver> source(new Driver());
+	source->loadFromFile(const_cast<char *>(filename.c_str()));
+	return source->getRowsNumber() > 0 && gene_driver.addSource(source, 1.0, -1);
+}
+
+
+bool Engine::loadConditionDriver(const string& filename)
+{
+	shared_ptr<Driver> source(new Driver());
+	source->loadFromFile(const_cast<char *>(filename.c_str()));
+	return source->getRowsNumber() > 0 && condition_driver.addSource(source, 1.0, -1);
+}
+
+
+bool Engine::loadGeneAnnotations(const string& filename, size_t cache_bytes)
+{
+	shared_ptr<Driver> source(new Driver());
+	source->loadAnnotationsFromFile(const_cast<char *>(filename.c_str()), cache_bytes);
+	return source->getRowsNumber() > 0 && gene_driver.addSource(source, 1.0, -1);
+}
+
+
+bool Engine::loadConditionAnnotations(const string& filename, size_t cache_bytes)
+{
+	shared_ptr<Driver> source(new Driver());
+	source->loadAnnotationsFromFile(const_cast<char *>(filename.c_str()), cache_bytes);
+	return source->getRowsNumber() > 0 && condition_driver.addSource(source, 1.0, -1);
+}
+
+
+bool Engine::loadGeneEmbeddings(const string& filename, metric_t metric)
+{
+	shared_ptr<Driver> source(new Driver());
+	source->loadEmbeddingsFromFile(const_cast<char *>(filename.c_str()), metric);
+	return source->getRowsNumber() > 0 && gene_driver.addSource(source, 1.0, -1);
+}
+
+
+bool Engine::loadConditionEmbeddings(const string& filename, metric_t metric)
+{
+	shared_ptr<Driver> source(new Driver());
+	source->loadEmbeddingsFromFile(const_cast<char *>(filename.c_str()), metric);
+	return source->getRowsNumber() > 0 && condition_driver.addSource(source, 1.0, -1);
+}
+
+
+bool Engine::loadGeneSource(const string& source, const string& kind, size_t cache_bytes, metric_t metric)
+{
+	string filename = source, source_kind = kind;
+	parseSource(filename, source_kind);
+	if (source_kind == "annotations") return loadGeneAnnotations(filename, cache_bytes);
+	if (source_kind == "embeddings") return loadGeneEmbeddings(filename, metric);
+	return loadGeneDriver(filename);
+}
+
+
+bool Engine::loadConditionSource(const string& source, const string& kind, size_t cache_bytes, metric_t metric)
+{
+	string filename = source, source_kind = kind;
+	parseSource(filename, source_kind);
+	if (source_kind == "annotations") return loadConditionAnnotations(filename, cache_bytes);
+	if (source_kind == "embeddings") return loadConditionEmbeddings(filename, metric);
+	return loadConditionDriver(filename);
+}
+
+
+void Engine::parseSource(string& filename, string& kind)
+{
+	const char* kinds[] = { "distances", "annotations", "embeddings" };
+	for (unsigned int k=0; k<3; k++)
+		if (filename.compare(0, strlen(kinds[k]) + 1, string(kinds[k]) + ":") == 0)
+		{
+			kind = kinds[k];
+			filename = filename.substr(kind.size() + 1);
+		}
+}
+
+
+bool Engine::parseFusion(const string& weights_list, const string& missing_list, unsigned int n, floatvect& weights, floatvect& missing)
+{
+	weights.assign(n, 1.0);
+	missing.assign(n, -1);
+	
+	istringstream ws(weights_list), ms(missing_list);
+	string t;
+	for (unsigned int k=0; !weights_list.empty() && getline(ws, t, ','); k++)
+	{
+		istringstream ts(t);
+		if (k >= n || !(ts >> weights[k]) || !ts.eof() || weights[k] < 0) return false;
+	}
+	for (unsigned int k=0; !missing_list.empty() && getline(ms, t, ','); k++)
+	{
+		if (k >= n) return false;
+		if (t == "skip") continue;
+		istringstream ts(t);
+		if (!(ts >> missing[k]) || !ts.eof() || missing[k] < 0) return false;
+	}
+	return true;
+}
+
+
+unsigned int Engine::getGeneSourcesNumber()
+{
+	return gene_driver.getSourcesNumber();
+}
+
+
+unsigned int Engine::getConditionSourcesNumber()
+{
+	return condition_driver.getSourcesNumber();
+}
+
+
+bool Engine::weighGeneSources(const floatvect& weights, const floatvect& missing)
+{
+	return gene_driver.weighSources(weights, missing);
+}
+
+
+bool Engine::weighConditionSources(const floatvect& weights, const floatvect& missing)
+{
+	return condition_driver.weighSources(weights, missing);
+}
+
+
+unsigned int Engine::indexDrivers(float recall, bool validate)
+{
+	unsigned int n = 0;
+	if (gene_driver.buildIndex(recall, validate)) n++;
+	if (condition_driver.buildIndex(recall, validate)) n++;
+	return n;
+}
+
+
+string Engine::indexReport()
+{
+	string report;
+	if (gene_driver.hasIndex()) report += "\tGene index: " + gene_driver.indexReport() + "\n";
+	if (condition_driver.hasIndex()) report += "\tCondition index: " + condition_driver.indexReport() + "\n";
+	return report;
+}
+
+
+//it marks the fraction of the objects having the lowest values (ties are broken by index)
+static void drop_lowest(const floatvect& values, float fraction, vector<bool>& dropped)
+{
+	const unsigned int n = values.size();
+	unsigned int lowest = (unsigned int) (fraction*n);
+	if (lowest == 0) return;
+	vector< pair<float, int> > ranking(n);
+	for (unsigned int i=0; i<n; i++) ranking[i] = make_pair(values[i], i);
+	nth_element(ranking.begin(), ranking.begin() + lowest - 1, ranking.end());
+	for (unsigned int r=0; r<lowest; r++) dropped[ranking[r].second] = true;
+}
+
+
+bool Engine::filterGenes(float min_variance, float variance_quantile, float expression_quantile)
+{
+	floatvect variances = E.rowVariances();
+	if (variances.empty()) return false;
+	
+	//genes are ranked by variance and by mean expression, and the first of each ranking are dropped
+	vector<bool> dropped(num_genes, false);
+	for (unsigned int i=0; i<num_genes; i++) dropped[i] = variances[i] < min_variance;
+	drop_lowest(variances, variance_quantile, dropped);
+	if (expression_quantile > 0.0) drop_lowest(E.rowMeans(), expression_quantile, dropped);
+	intvect kept;
+	for (unsigned int i=0; i<num_genes; i++)
+		if (!dropped[i]) kept.push_back(i);
+	if (kept.empty()) return false;
+	
+	if (!E.keepRows(kept)) return false;
+	
+	//genes filtered again are mapped through the previous filter
+	if (kept_genes.empty()) num_loaded_genes = num_genes;
+	else
+		for (unsigned int i=0; i<kept.size(); i++) kept[i] = kept_genes[kept[i]];
+	kept_genes = kept;
+	num_genes = kept.size();
+	
+	//the distances of the driver are held by its sources, which its copy shares
+	if (!loaded_gene_driver && gene_driver.getRowsNumber() > 0) loaded_gene_driver = make_shared<Driver>(gene_driver);
+	if (loaded_gene_driver) gene_driver = loaded_gene_driver->view(kept_genes);
+	return true;
+}
+
+
+const intvect& Engine::getKeptGenes()
+{
+	return kept_genes;
+}
+
+
+unsigned int Engine::getLoadedGenesNumber()
+{
+	return kept_genes.empty() ? num_genes : num_loaded_genes;
+}
+
+
+void Engine::prepare(precision_t precision, bool keep_reference, scalar_t accumulation)
+{
+	Trace::Scope scope("prepare", "engine");
+	E_g = E.traspose();
+	E_g.normalize();
+	E_c = E.copy();
+	E_c.normalize();
+
+	//reference fp32 matrices are kept only when the reduced precision has to be validated
+	if (keep_reference)
+	{
+		E_g_fp32 = E_g.copy();
+		E_c_fp32 = E_c.copy();
+	}
+	E_g.compress(precision);
+	E_c.compress(precision);
+	E_g.setAccumulation(accumulation);
+	E_c.setAccumulation(accumulation);
+	E_g_fp32.setAccumulation(accumulation);
+	E_c_fp32.setAccumulation(accumulation);
+
+	E.clear(); //raw data are no longer needed
+}
+
+
+unsigned int Engine::getGenesNumber()
+{
+	return num_genes;
+}
+
+
+unsigned int Engine::getConditionsNumber()
+{
+	return num_conditions;
+}
+
+
+//indices 0, ..., n - 1
+static intvect identity(unsigned int n)
+{
+	intvect index(n);
+	for (unsigned int i=0; i<n; i++) index[i] = i;
+	return index;
+}
+
+
+//whether the indices are distinct and less than n
+static bool distinct(const intvect& index, unsigned int n)
+{
+	vector<bool> seen(n, false);
+	for (unsigned int i=0; i<index.size(); i++)
+	{
+		if (index[i] < 0 || (unsigned int) index[i] >= n || seen[index[i]]) return false;
+		seen[index[i]] = true;
+	}
+	return true;
+}
+
+
+//cluster of the objects index[k] of the data set, from the objects k of a subset of n of them
+static Cluster to_global(const Cluster& cluster, const intvect& index, unsigned int n)
+{
+	floatvect values(n, 0.0);
+	for (unsigned int k=0; k<index.size(); k++) values[index[k]] = cluster.getValue(k);
+	return Cluster(values);
+}
+
+
+//and back
+static Cluster to_subset(const Cluster& cluster, const intvect& index)
+{
+	floatvect values(index.size());
+	for (unsigned int k=0; k<index.size(); k++) values[k] = cluster.getValue(index[k]);
+	return Cluster(values);
+}
+
+
+static Bicluster to_global(const Bicluster& bicluster, const intvect& genes, const intvect& conditions, unsigned int num_genes, unsigned int num_conditions)
+{
+	Cluster g = to_global(bicluster.getGeneCluster(), genes, num_genes), c = to_global(bicluster.getConditionCluster(), conditions, num_conditions);
+	return Bicluster(g, c);
+}
+
+
+static Bicluster to_subset(const Bicluster& bicluster, const intvect& genes, const intvect& conditions)
+{
+	Cluster g = to_subset(bicluster.getGeneCluster(), genes), c = to_subset(bicluster.getConditionCluster(), conditions);
+	return Bicluster(g, c);
+}
+
+
+//it forwards the biclusters found on a subset, mapped to the data set
+class subset_handler : public ResultHandler
+{
+	ResultHandler* handler;
+	const intvect& genes;
+	const intvect& conditions;
+	unsigned int num_genes;
+	unsigned int num_conditions;
+
+public:
+
+	subset_handler(ResultHandler* h, const intvect& g, const intvect& c, unsigned int ng, unsigned int nc)
+	: handler(h), genes(g), conditions(c), num_genes(ng), num_conditions(nc) {}
+
+	void found(Bicluster& bicluster, unsigned long cell)
+	{
+		Bicluster mapped = to_global(bicluster, genes, conditions, num_genes, num_conditions);
+		handler->found(mapped, cell);
+	}
+
+	bool cancelled() { return handler->cancelled(); }
+};
+
+
+job_status_t Engine::run(const JobConfig& job, Biclustervect& results, cellvect& found_at, ResultHandler* handler, JobStats* stats)
+{
+	if ((job.if_row_driver && gene_driver.getRowsNumber() == 0) || (job.if_col_driver && condition_driver.getRowsNumber() == 0)) return job_invalid;
+	if (job.shards == 0 || job.shard >= job.shards) return job_invalid;
+	if (job.saturation > 0.0 && (job.shards > 1 || !job.checkpoint_filename.empty())) return job_invalid;
+	for (unsigned int s=0; s<job.warm_seeds.size(); s++)
+		if (job.warm_seeds[s].getGeneCluster().getCluster().size() != num_genes || job.warm_seeds[s].getConditionCluster().getCluster().size() != num_conditions) return job_invalid;
+
+	//without reference matrices, the job runs on the only ones
+	bool reference = job.reference && E_g_fp32.getRowsNumber() > 0;
+	if (job.gene_subset.empty() && job.condition_subset.empty())
+		return sweep(job, reference ? E_g_fp32 : E_g, reference ? E_c_fp32 : E_c, gene_driver, condition_driver, results, found_at, handler, stats);
+
+	intvect genes = job.gene_subset, conditions = job.condition_subset;
+	if (genes.empty()) genes = identity(num_genes);
+	if (conditions.empty()) conditions = identity(num_conditions);
+	if (!distinct(genes, num_genes) || !distinct(conditions, num_conditions)) return job_invalid;
+	Matrix V_c = (reference ? E_c_fp32 : E_c).view(genes, conditions, intvect());
+	if (V_c.getRowsNumber() == 0) return job_invalid;
+	Matrix V_g = V_c.traspose();
+	Driver gene_view = (gene_driver.getRowsNumber() > 0) ? gene_driver.view(genes) : Driver();
+	Driver condition_view = (condition_driver.getRowsNumber() > 0) ? condition_driver.view(conditions) : Driver();
+
+	JobConfig subset_job = job;
+	for (unsigned int s=0; s<job.warm_seeds.size(); s++)
+		subset_job.warm_seeds[s] = to_subset(job.warm_seeds[s], genes, conditions);
+	subset_handler mapping(handler, genes, conditions, num_genes, num_conditions);
+	Biclustervect subset_results;
+	cellvect subset_found_at;
+	job_status_t status = sweep(subset_job, V_g, V_c, gene_view, condition_view, subset_results, subset_found_at, (handler != NULL) ? &mapping : NULL, stats);
+	for (unsigned int b=0; b<subset_results.size(); b++)
+	{
+		results.push_back(to_global(subset_results[b], genes, conditions, num_genes, num_conditions));
+		found_at.push_back(subset_found_at[b]);
+	}
+	return status;
+}
+
+
+//size of the intersection of two sorted lists
+static unsigned int intersection(const intvect& a, const intvect& b)
+{
+	unsigned int common = 0;
+	intvect::const_iterator i = a.begin(), j = b.begin();
+	while (i != a.end() && j != b.end())
+	{
+		if (*i < *j) i++;
+		else if (*j < *i) j++;
+		else
+		{
+			common++;
+			i++;
+			j++;
+		}
+	}
+	return common;
+}
+
+
+//Jaccard index of the elements of a cluster and a sorted list
+static float jaccard(const Cluster& cluster, const intvect& elements, intvect& buffer)
+{
+	cluster.getElements(buffer);
+	float common = intersection(buffer, elements);
+	return (common > 0) ? common/(buffer.size() + elements.size() - common) : 0.0;
+}
+
+
+//the threshold pair of each warm seed: the one whose condition and gene signatures, after a single iteration from
+//the seed, are the most similar to those of the seed (ties are broken by the lowest thresholds); false if a product
+//cannot be evaluated
+static bool warm_pairs(const Biclustervect& seeds, Matrix& E_g_job, Matrix& E_c_job, const floatvect& gene_thresholds, const floatvect& condition_thresholds, intvect& pairs)
+{
+	const unsigned int n = seeds.size();
+	floatmatrix in(n), out;
+	for (unsigned int k=0; k<n; k++) in[k] = seeds[k].getGeneCluster().getCluster();
+	if (!E_g_job.batch_product(in, out)) return false;
+	
+	intvect genes, conditions, buffer;
+	vector<unsigned int> best_condition(n, 0);
+	Cluster candidate;
+	for (unsigned int k=0; k<n; k++)
+	{
+		seeds[k].getConditionCluster().getElements(conditions);
+		unsigned int seed_genes = seeds[k].getGeneCluster().size();
+		float best = -1.0;
+		for (unsigned int c=0; c<condition_thresholds.size(); c++)
+		{
+			floatvect product = out[k];
+			candidate.signature(product, seed_genes, condition_thresholds[c]);
+			float similarity = jaccard(candidate, conditions, buffer);
+			if (similarity <= best) continue;
+			best = similarity;
+			best_condition[k] = c;
+			in[k] = candidate.getCluster();
+		}
+	}
+	if (!E_c_job.batch_product(in, out)) return false;
+	
+	pairs.assign(n, 0);
+	for (unsigned int k=0; k<n; k++)
+	{
+		seeds[k].getGeneCluster().getElements(genes);
+		unsigned int condition_size = 0;
+		for (unsigned int j=0; j<in[k].size(); j++) if (in[k][j] != 0.0) condition_size++;
+		float best = -1.0;
+		for (unsigned int g=0; g<gene_thresholds.size(); g++)
+		{
+			floatvect product = out[k];
+			candidate.signature(product, condition_size, gene_thresholds[g]);
+			float similarity = jaccard(candidate, genes, buffer);
+			if (similarity <= best) continue;
+			best = similarity;
+			pairs[k] = best_condition[k]*gene_thresholds.size() + g;
+		}
+	}
+	return true;
+}
+
+
+//FNV-1a hash of a list of indices (and of its length), continuing the given one
+static const uint64_t fnv_offset = 14695981039346656037ULL;
+static uint64_t hash_indices(const intvect& indices, uint64_t hash)
+{
+	const uint64_t prime = 1099511628211ULL;
+	hash = (hash ^ indices.size())*prime;
+	for (unsigned int i=0; i<indices.size(); i++)
+		hash = (hash ^ (uint32_t) indices[i])*prime;
+	return hash;
+}
+
+
+//Good-Turing and Chao1 estimates, from how many times each bicluster has been found
+static void estimate(const vector<unsigned int>& hits, JobStats& stats)
+{
+	stats.singletons = count(hits.begin(), hits.end(), 1u);
+	stats.doubletons = count(hits.begin(), hits.end(), 2u);
+	float f1 = stats.singletons, f2 = stats.doubletons;
+	stats.expected_yield = (stats.runs > 0) ? f1/stats.runs : 0.0;
+	stats.unseen = (f2 > 0) ? f1*f1/(2.0*f2) : (f1 > 1) ? f1*(f1 - 1)/2.0 : 0.0;
+}
+
+
+//it orders cells by the new biclusters found per cell by their threshold pair, the most productive first
+struct yield_order
+{
+	const vector<unsigned int>& found;
+	const vector<unsigned int>& evaluated;
+	unsigned long cells_per_run;
+
+	yield_order(const vector<unsigned int>& f, const vector<unsigned int>& e, unsigned long c) : found(f), evaluated(e), cells_per_run(c) {}
+	
+	double yield(unsigned long cell) const
+	{
+		unsigned long pair = cell % cells_per_run;
+		return (found[pair] + 1.0)/(evaluated[pair] + 2.0);
+	}
+	
+	bool operator()(unsigned long a, unsigned long b) const { return yield(a) > yield(b); }
+};
+
+
+job_status_t Engine::sweep(const JobConfig& job, Matrix& E_g_job, Matrix& E_c_job, Driver& gene_driver_job, Driver& condition_driver_job, 
+                           Biclustervect& results, cellvect& found_at, ResultHandler* handler, JobStats* stats)
+{
+	floatvect gene_thresholds = job.gene_thresholds;
+	floatvect condition_thresholds = job.condition_thresholds;
+	if (gene_thresholds.empty() && condition_thresholds.empty()) thresholds(gene_thresholds, condition_thresholds);
+	if (gene_thresholds.empty() || condition_thresholds.empty()) return job_invalid;
+	unsigned long cells_per_run = gene_thresholds.size()*condition_thresholds.size();
+	unsigned int warm_runs = job.warm_seeds.size();
+	unsigned int runs = warm_runs + job.runs_number; //warm runs first
+
+	//the checkpoint is identified by the parameters that determine the grid and its results, and by the genes and
+	//conditions it runs on, since subsets, filters and warm seeds of the same size give another grid
+	Checkpoint* checkpoint = NULL;
+	if (!job.checkpoint_filename.empty())
+	{
+		uint64_t data_hash = hash_indices(job.gene_subset, fnv_offset);
+		data_hash = hash_indices(job.condition_subset, data_hash);
+		data_hash = hash_indices(kept_genes, data_hash);
+		intvect elements;
+		for (unsigned int s=0; s<job.warm_seeds.size(); s++)
+		{
+			job.warm_seeds[s].getGeneCluster().getElements(elements);
+			data_hash = hash_indices(elements, data_hash);
+			job.warm_seeds[s].getConditionCluster().getElements(elements);
+			data_hash = hash_indices(elements, data_hash);
+		}
+		checkpoint = new Checkpoint(job.checkpoint_filename, job.checkpoint_interval, E_c_job.getRowsNumber(), E_c_job.getColumnsNumber(), runs, cells_per_run,
+		                            job.seed, job.shard, job.shards, job.delta_reduce, job.delta_expand, job.if_row_driver, job.if_col_driver, data_hash);
+		if (job.resume)
+		{
+			if (!checkpoint->load(results, found_at))
+			{
+				delete checkpoint;
+				return job_invalid;
+			}
+			if (job.verbose) cout << "\tresuming: " << checkpoint->doneNumber() << " cells evaluated, " << results.size() << " biclusters" << endl;
+		}
+	}
+
+	//warm runs evaluate a single threshold pair
+	intvect warm_pair;
+	if (warm_runs > 0 && !warm_pairs(job.warm_seeds, E_g_job, E_c_job, gene_thresholds, condition_thresholds, warm_pair))
+	{
+		delete checkpoint;
+		return job_failed;
+	}
+
+	cellvect cells;
+	for(unsigned long cell=job.shard; cell<runs*cells_per_run; cell+=job.shards)
+		if ((checkpoint == NULL || !checkpoint->isDone(cell)) && (cell/cells_per_run >= warm_runs || cell % cells_per_run == (unsigned long) warm_pair[cell/cells_per_run]))
+			cells.push_back(cell);
+
+	Bicluster initial_signature;
+	unsigned int seed_run = runs; //run of initial_signature
+	unsigned int batch_size = max(job.batch_size, 1u);
+	job_status_t status = job_completed;
+
+	//discovery statistics: how many times each bicluster has been found (once, for those of a checkpoint)
+	JobStats job_stats;
+	vector<unsigned int> hits(results.size(), 1);
+	unsigned int run_first_result = results.size();
+	
+	//yield of each threshold pair, by which the cells of a run are ordered when the job has a time budget
+	vector<unsigned int> pair_found(cells_per_run, 0);
+	vector<unsigned int> pair_evaluated(cells_per_run, 0);
+	vector<bool> abandoned;
+
+	//the batch and the workspace are reused by all the seeds, so that iterations do not allocate
+	IsaWorkspace workspace;
+	Biclustervect batch;
+	floatvect batch_gene_thresholds;
+	floatvect batch_condition_thresholds;
+	workspace.deadline = (job.time_budget > 0.0) ? omp_get_wtime() + job.time_budget : 0.0;
+
+	for(unsigned long first=0, last=0; first<cells.size() && status == job_completed; first=last)
+	{
+		if (job.time_budget > 0.0 && cells[first]/cells_per_run != seed_run)
+		{
+			unsigned long run_end = first;
+			while (run_end < cells.size() && cells[run_end]/cells_per_run == cells[first]/cells_per_run) run_end++;
+			stable_sort(cells.begin() + first, cells.begin() + run_end, yield_order(pair_found, pair_evaluated, cells_per_run));
+		}
+		
+		last = min(first + batch_size, (unsigned long) cells.size());
+		if (job.saturation > 0.0 || job.time_budget > 0.0) //a run depends on the results of the previous ones, so that batches do not cross runs
+			while (cells[last - 1]/cells_per_run != cells[first]/cells_per_run) last--;
+		Trace::Scope batch_scope("batch", "sweep", "first cell", cells[first]);
+		batch.resize(last - first);
+		batch_gene_thresholds.resize(last - first);
+		batch_condition_thresholds.resize(last - first);
+
+		for(unsigned long k=first; k<last; k++)
+		{
+			unsigned int r = cells[k]/cells_per_run;
+			if (r != seed_run)
+			{
+				if (job.verbose) cout << "\tRun: " << r << "/" << runs << ((r < warm_runs) ? " (warm)" : "") << endl;
+				if (r < warm_runs) initial_signature = job.warm_seeds[r];
+				else
+				{
+					//random runs draw the same seeds as without warm runs
+					random_generator rng(job.seed, r - warm_runs);
+					initial_signature.initializeSignature(E_c_job.getRowsNumber(), rng);
+				}
+				seed_run = r;
+				job_stats.runs++;
+				run_first_result = results.size();
+			}
+
+			//each seed will be evaluated on all the possible gene_threshold
+			batch[k - first] = initial_signature;
+			batch_gene_thresholds[k - first] = gene_thresholds[cells[k] % gene_thresholds.size()];
+			batch_condition_thresholds[k - first] = condition_thresholds[(cells[k]/gene_thresholds.size()) % condition_thresholds.size()];
+		}
+
+		double batch_start = Trace::enabled() ? Trace::now() : 0.0;
+		Bicluster::batchIterativeSignatureAlgorithm(batch, E_g_job, E_c_job, batch_gene_thresholds, batch_condition_thresholds, gene_driver_job, condition_driver_job, job.delta_reduce, job.delta_expand, job.if_row_driver, job.if_col_driver, &workspace);
+		if (Trace::enabled())
+			for(unsigned long k=first; k<last; k++)
+				Trace::seed(cells[k], batch_start, workspace.finished[k - first], workspace.iterations[k - first], workspace.iterations[k - first] > max_isa_runs);
+		
+		//the cells of a batch whose products could not be evaluated are left unevaluated, and the job stops
+		if (workspace.failed)
+		{
+			if (checkpoint != NULL && !checkpoint->save(results, found_at)) cout << "WARNING: I cannot save the checkpoint" << endl;
+			status = job_failed;
+			break;
+		}
+
+		//the trajectories abandoned at the deadline are left unevaluated
+		abandoned.assign(last - first, false);
+		if (workspace.expired)
+			for(unsigned int a=0; a<workspace.active.size(); a++)
+				abandoned[workspace.active[a]] = true;
+
+		{
+			Trace::Scope scope("collect", "sweep", "biclusters", results.size());
+			for(unsigned long k=first; k<last; k++)
+			{
+				if (abandoned[k - first]) continue;
+				unsigned int position = numeric_limits<unsigned int>::max(); //left unset by void biclusters
+				if (collect(results, found_at, batch[k - first], cells[k], &position) && handler != NULL)
+					handler->found(results.back(), cells[k]);
+				if (position == hits.size())
+				{
+					hits.push_back(0);
+					pair_found[cells[k] % cells_per_run]++;
+				}
+				if (position < hits.size())
+				{
+					hits[position]++;
+					job_stats.observations++;
+				}
+				pair_evaluated[cells[k] % cells_per_run]++;
+				job_stats.cells++;
+			}
+		}
+		
+		//the yield of the next run is estimated once a run is completed
+		bool run_completed = !workspace.expired && (last == cells.size() || cells[last]/cells_per_run != cells[last - 1]/cells_per_run);
+		if (job.saturation > 0.0 && run_completed)
+		{
+			estimate(hits, job_stats);
+			if (job.verbose)
+				cout << "\t\t" << results.size() - run_first_result << " new biclusters, " << job_stats.singletons << " found once, " << job_stats.doubletons << " found twice: "
+				     << job_stats.expected_yield << " new expected from the next run, " << job_stats.unseen << " not found yet" << endl;
+			if (job_stats.runs >= 2 && job_stats.expected_yield < job.saturation && last < cells.size())
+			{
+				job_stats.saturated = true;
+				break;
+			}
+		}
+
+		bool expired = workspace.deadline > 0.0 && (workspace.expired || omp_get_wtime() >= workspace.deadline);
+		if (checkpoint != NULL)
+		{
+			Trace::Scope scope("checkpoint", "sweep");
+			for(unsigned long k=first; k<last; k++)
+				if (!abandoned[k - first]) checkpoint->setDone(cells[k]);
+			if (!(expired ? checkpoint->save(results, found_at) : checkpoint->update(results, found_at)))
+				cout << "WARNING: I cannot save the checkpoint" << endl;
+			if (Checkpoint::terminationRequested()) status = job_interrupted;
+		}
+		if (handler != NULL && handler->cancelled()) status = job_interrupted;
+		
+		if (expired)
+		{
+			job_stats.expired = workspace.expired || last < cells.size();
+			if (job.verbose && job_stats.expired) cout << "\tTime budget elapsed: " << job_stats.cells << "/" << cells.size() << " cells evaluated" << endl;
+			break;
+		}
+	}
+
+	delete checkpoint;
+	estimate(hits, job_stats);
+	if (stats != NULL) *stats = job_stats;
+	return status;
+}
+
+
+string Engine::partialHeader(const JobConfig& job)
+{
+	floatvect gene_thresholds = job.gene_thresholds;
+	floatvect condition_thresholds = job.condition_thresholds;
+	if (gene_thresholds.empty() && condition_thresholds.empty()) thresholds(gene_thresholds, condition_thresholds);
+	
+	ostringstream header;
+	header << "#AID-ISA partial " << getLoadedGenesNumber() << " " << num_conditions << " " << job.shard << "/" << job.shards << " "
+	       << job.seed << " " << job.warm_seeds.size() + job.runs_number << " " << gene_thresholds.size()*condition_thresholds.size() << " "
+	       << job.delta_reduce << " " << job.delta_expand << " " << ((job.if_row_driver ? 1 : 0) | (job.if_col_driver ? 2 : 0));
+	return header.str();
+}
+
+
+void Engine::thresholds(floatvect& gene_thresholds, floatvect& condition_thresholds)
+{
+	//the gene_threshold determine the resolution of the modular decomposition.
+	//By varying it, it is possible to discover multiple biclusters.
+	float condition_threshold = min_condition_threshold;
+	while(condition_threshold <= max_condition_threshold)
+	{
+		condition_thresholds.push_back(condition_threshold);
+		condition_threshold += condition_threshold_step;
+	}
+
+	float gene_threshold = min_gene_threshold;
+	while(gene_threshold <= max_gene_threshold)
+	{
+		gene_thresholds.push_back(gene_threshold);
+		gene_threshold += gene_threshold_step;
+	}
+}
+
+
+bool Engine::collect(Biclustervect& results, cellvect& found_at, Bicluster& signature, unsigned long cell, unsigned int* position)
+{
+	//void bicluster are discarded
+	if (signature.getGeneCluster().size() == 0) return false;
+
+	//check if the evaluated bicluster is already known
+	for (unsigned int b=0; b<results.size(); b++)
+		if (signature.equal(results[b]))
+		{
+			if (position != NULL) *position = b;
+			return false;
+		}
+
+	if (position != NULL) *position = results.size();
+	results.push_back(signature);
+	found_at.push_back(cell);
+	return true;
+}
+
+
+unsigned int Engine::consolidate(Biclustervect& results, cellvect& found_at, float overlap)
+{
+	Trace::Scope scope("consolidate", "engine", "biclusters", results.size());
+	const long n = results.size();
+	vector<intvect> genes(n), conditions(n);
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (long b=0; b<n; b++)
+	{
+		genes[b] = results[b].getGeneCluster().getElements();
+		conditions[b] = results[b].getConditionCluster().getElements();
+	}
+	
+	//genes are ranked from the rarest: two gene sets with Jaccard index t share at least ceil(t*s) genes, hence their 
+	//first k common genes are among the first s - ceil(t*s) + k genes of each of them (s the set size), so that only 
+	//these prefixes are indexed and a pair sharing less than k of their genes is discarded without intersecting it
+	intvect frequency;
+	for (long b=0; b<n; b++)
+		for (unsigned int k=0; k<genes[b].size(); k++)
+		{
+			if ((unsigned int) genes[b][k] >= frequency.size()) frequency.resize(genes[b][k] + 1, 0);
+			frequency[genes[b][k]]++;
+		}
+	vector< pair<int, int> > ranking;
+	for (unsigned int g=0; g<frequency.size(); g++) ranking.push_back(make_pair(frequency[g], g));
+	sort(ranking.begin(), ranking.end());
+	intvect rank(frequency.size());
+	for (unsigned int r=0; r<ranking.size(); r++) rank[ranking[r].second] = r;
+	
+	const size_t k = 2;
+	vector<intvect> prefixes(n);
+	vector<size_t> guaranteed(n); //the common genes surely within the prefix, k unless the prefix is the whole set
+	vector<intvect> index(frequency.size()); //the biclusters whose prefix includes each gene, in increasing order
+	for (long b=0; b<n; b++)
+	{
+		intvect& prefix = prefixes[b];
+		for (unsigned int g=0; g<genes[b].size(); g++) prefix.push_back(rank[genes[b][g]]);
+		sort(prefix.begin(), prefix.end());
+		size_t s = prefix.size();
+		size_t least = (size_t) ceil(overlap*s - 1e-6);
+		prefix.resize(min(s, s - least + k));
+		guaranteed[b] = least + prefix.size() - s;
+		for (unsigned int g=0; g<prefix.size(); g++)
+			index[ranking[prefix[g]].second].push_back(b);
+	}
+	
+	//the overlap of cells is at most the Jaccard index of both the gene and the condition sets 
+	vector< vector< pair<int, int> > > similar(omp_get_max_threads());
+	#pragma omp parallel
+	{
+		vector<unsigned int> shared(n, 0);
+		intvect touched;
+		vector< pair<int, int> >& pairs = similar[omp_get_thread_num()];
+		
+		#pragma omp for schedule(dynamic, 64)
+		for (long b=0; b<n; b++)
+		{
+			touched.clear();
+			for (unsigned int g=0; g<prefixes[b].size(); g++)
+			{
+				const intvect& list = index[ranking[prefixes[b][g]].second];
+				for (intvect::const_iterator it = upper_bound(list.begin(), list.end(), (int) b); it != list.end(); it++)
+					if (shared[*it]++ == 0) touched.push_back(*it);
+			}
+			
+			for (unsigned int t=0; t<touched.size(); t++)
+			{
+				int c = touched[t];
+				size_t shared_prefix = shared[c];
+				shared[c] = 0;
+				if (shared_prefix < min(guaranteed[b], guaranteed[c])) continue;
+				
+				double sizes = genes[b].size() + genes[c].size();
+				if (min(genes[b].size(), genes[c].size()) < overlap*max(genes[b].size(), genes[c].size())) continue;
+				
+				double common_genes = intersection(genes[b], genes[c]);
+				if (common_genes < overlap*(sizes - common_genes)) continue;
+				
+				double cells = (double) genes[b].size()*conditions[b].size() + (double) genes[c].size()*conditions[c].size();
+				double common_cells = common_genes*intersection(conditions[b], conditions[c]);
+				if (common_cells > 0 && common_cells >= overlap*(cells - common_cells)) pairs.push_back(make_pair((int) b, c));
+			}
+		}
+	}
+	
+	//groups are the connected components of similar pairs, represented by their first bicluster
+	intvect parent(n);
+	for (long b=0; b<n; b++) parent[b] = b;
+	for (unsigned int t=0; t<similar.size(); t++)
+		for (unsigned int k=0; k<similar[t].size(); k++)
+		{
+			int a = similar[t][k].first, c = similar[t][k].second;
+			while (parent[a] != a) a = parent[a] = parent[parent[a]];
+			while (parent[c] != c) c = parent[c] = parent[parent[c]];
+			if (a != c) parent[max(a, c)] = min(a, c);
+		}
+	
+	Biclustervect kept;
+	cellvect kept_found_at;
+	for (long b=0; b<n; b++)
+	{
+		int r = b;
+		while (parent[r] != r) r = parent[r];
+		if (r != b) continue;
+		kept.push_back(results[b]);
+		kept_found_at.push_back(found_at[b]);
+	}
+	
+	unsigned int merged = n - kept.size();
+	results.swap(kept);
+	found_at.swap(kept_found_at);
+	return merged;
+}
+
+
+//it centers the profile and scales it to unit norm, returning false if it is constant
+static bool standardize(float* x, size_t n)
+{
+	double sum = 0.0;
+	for (size_t k=0; k<n; k++) sum += x[k];
+	float mean = sum/n;
+	double squares = 0.0;
+	for (size_t k=0; k<n; k++)
+	{
+		x[k] -= mean;
+		squares += (double) x[k]*x[k];
+	}
+	if (squares < 1e-12) return false;
+	float inverse = 1.0/sqrt(squares);
+	for (size_t k=0; k<n; k++) x[k] *= inverse;
+	return true;
+}
+
+
+//mean of the known distances, -1 if there is none
+static float mean_distance(const floatvect& distances)
+{
+	double sum = 0.0;
+	unsigned long count = 0;
+	for (size_t p=0; p<distances.size(); p++)
+		if (distances[p] != -1)
+		{
+			sum += distances[p];
+			count++;
+		}
+	return count > 0 ? sum/count : -1;
+}
+
+
+void Engine::score(Biclustervect& results, Qualityvect& scores)
+{
+	scoreOn(E_c, gene_driver, condition_driver, results, scores);
+}
+
+
+void Engine::scoreOn(Matrix& E_c_job, Driver& gene_driver_job, Driver& condition_driver_job, Biclustervect& results, Qualityvect& scores)
+{
+	Trace::Scope scope("score", "engine", "biclusters", results.size());
+	const long n = results.size();
+	scores.assign(n, Quality());
+	
+	#pragma omp parallel
+	{
+		floatvect sub, signature, distances;
+		vector<double> row_mean, col_mean;
+		vector<char> varies;
+		
+		#pragma omp for schedule(dynamic, 1)
+		for (long b=0; b<n; b++)
+		{
+			const Cluster& gene = results[b].getGeneCluster();
+			const Cluster& condition = results[b].getConditionCluster();
+			intvect genes = gene.getElements();
+			intvect conditions = condition.getElements();
+			const size_t nr = genes.size(), nc = conditions.size();
+			Quality& q = scores[b];
+			
+			if (gene_driver_job.getRowsNumber() > 0)
+			{
+				gene_driver_job.gather(genes, distances);
+				q.gene_distance = mean_distance(distances);
+			}
+			if (condition_driver_job.getRowsNumber() > 0)
+			{
+				condition_driver_job.gather(conditions, distances);
+				q.condition_distance = mean_distance(distances);
+			}
+			if (nr == 0 || nc == 0) continue;
+			
+			//mean squared residue
+			E_c_job.gather(genes, conditions, sub);
+			row_mean.assign(nr, 0.0);
+			col_mean.assign(nc, 0.0);
+			double total = 0.0;
+			for (size_t i=0; i<nr; i++)
+				for (size_t j=0; j<nc; j++)
+				{
+					row_mean[i] += sub[i*nc + j];
+					col_mean[j] += sub[i*nc + j];
+				}
+			for (size_t i=0; i<nr; i++)
+			{
+				total += row_mean[i];
+				row_mean[i] /= nc;
+			}
+			for (size_t j=0; j<nc; j++) col_mean[j] /= nr;
+			double mean = total/(nr*nc);
+			double residue = 0.0;
+			for (size_t i=0; i<nr; i++)
+				for (size_t j=0; j<nc; j++)
+				{
+					double r = sub[i*nc + j] - row_mean[i] - col_mean[j] + mean;
+					residue += r*r;
+				}
+			q.residue = residue/(nr*nc);
+			
+			//correlations between standardized profiles are their dot products
+			varies.assign(nr, 0);
+			for (size_t i=0; i<nr; i++) varies[i] = standardize(&sub[i*nc], nc);
+			
+			double correlation = 0.0;
+			unsigned long pairs = 0;
+			for (size_t a=0; a<nr; a++)
+			{
+				if (!varies[a]) continue;
+				for (size_t c=a+1; c<nr; c++)
+					if (varies[c])
+					{
+						float dot = 0.0;
+						for (size_t j=0; j<nc; j++) dot += sub[a*nc + j]*sub[c*nc + j];
+						correlation += fabs(dot);
+						pairs++;
+					}
+			}
+			q.correlation = pairs > 0 ? correlation/pairs : 0.0;
+			
+			signature.resize(nc);
+			for (size_t j=0; j<nc; j++) signature[j] = condition.getValue(conditions[j]);
+			if (standardize(&signature[0], nc))
+			{
+				double coherence = 0.0;
+				unsigned long profiles = 0;
+				for (size_t i=0; i<nr; i++)
+					if (varies[i])
+					{
+						float dot = 0.0;
+						for (size_t j=0; j<nc; j++) dot += sub[i*nc + j]*signature[j];
+						coherence += (gene.getValue(genes[i]) < 0) ? -dot : dot;
+						profiles++;
+					}
+				q.coherence = profiles > 0 ? coherence/profiles : 0.0;
+			}
+		}
+	}
+}
+
+
+//the key of a bicluster in the ranking, lower is better
+static float ranking_key(const Quality& q, quality_t by)
+{
+	switch (by)
+	{
+		case quality_residue: return q.residue;
+		case quality_correlation: return -q.correlation;
+		case quality_coherence: return -q.coherence;
+		case quality_gene_distance: return q.gene_distance == -1 ? numeric_limits<float>::infinity() : q.gene_distance;
+		default: return q.condition_distance == -1 ? numeric_limits<float>::infinity() : q.condition_distance;
+	}
+}
+
+
+void Engine::selectTop(Biclustervect& results, cellvect& found_at, Qualityvect& scores, quality_t by, unsigned int k)
+{
+	//the heap top is the worst of the biclusters kept so far
+	priority_queue< pair<float, unsigned int> > kept;
+	for (unsigned int b=0; b<results.size(); b++)
+	{
+		pair<float, unsigned int> key(ranking_key(scores[b], by), b);
+		if (kept.size() < k) kept.push(key);
+		else if (k > 0 && key < kept.top())
+		{
+			kept.pop();
+			kept.push(key);
+		}
+	}
+	
+	intvect order(kept.size());
+	for (long r=order.size()-1; r>=0; r--)
+	{
+		order[r] = kept.top().second;
+		kept.pop();
+	}
+	
+	Biclustervect top_results;
+	cellvect top_found_at;
+	Qualityvect top_scores;
+	for (unsigned int r=0; r<order.size(); r++)
+	{
+		top_results.push_back(results[order[r]]);
+		top_found_at.push_back(found_at[order[r]]);
+		top_scores.push_back(scores[order[r]]);
+	}
+	results.swap(top_results);
+	found_at.swap(top_found_at);
+	scores.swap(top_scores);
+}
+
+
+bool Engine::parseQuality(const string& s, quality_t& q)
+{
+	if (s == "residue") q = quality_residue;
+	else if (s == "correlation") q = quality_correlation;
+	else if (s == "coherence") q = quality_coherence;
+	else if (s == "gene_distance") q = quality_gene_distance;
+	else if (s == "condition_distance") q = quality_condition_distance;
+	else return false;
+	return true;
+}
+
+
+bool Engine::resample(const JobConfig& job, Biclustervect& results, Qualityvect& scores, unsigned int permutations, unsigned int bootstraps, quality_t by)
+{
+	intvect genes(num_genes), conditions(num_conditions);
+	for (unsigned int i=0; i<num_genes; i++) genes[i] = i;
+	for (unsigned int j=0; j<num_conditions; j++) conditions[j] = j;
+	if (E_c.view(genes, conditions, intvect()).getRowsNumber() == 0) return false;
+	if (!job.gene_subset.empty() || !job.condition_subset.empty()) return false;
+	
+	//replicates evaluate the whole grid of the job from the same seeds, and their buffers are reused
+	JobConfig replicate = job;
+	replicate.shard = 0;
+	replicate.shards = 1;
+	replicate.reference = false;
+	replicate.checkpoint_filename = "";
+	replicate.resume = false;
+	replicate.saturation = 0.0;
+	replicate.time_budget = 0.0;
+	replicate.verbose = false;
+	Biclustervect replicate_results;
+	cellvect replicate_found_at;
+	Qualityvect replicate_scores;
+	
+	//permutation null: each gene profile is rotated by its own shift, which keeps its values but not its correlations
+	vector< vector< pair<float, pair<unsigned int, unsigned int> > > > null(permutations); //(key, (genes, conditions))
+	intvect shifts(num_genes);
+	for (unsigned int p=0; p<permutations; p++)
+	{
+		Trace::Scope scope("permutation", "resample", "permutation", p);
+		random_generator rng(job.seed, job.runs_number + p);
+		for (unsigned int i=0; i<num_genes; i++) shifts[i] = rng.value(num_conditions);
+		Matrix V_c = E_c.view(genes, conditions, shifts);
+		Matrix V_g = V_c.traspose();
+		
+		replicate_results.clear();
+		replicate_found_at.clear();
+		if (sweep(replicate, V_g, V_c, gene_driver, condition_driver, replicate_results, replicate_found_at, NULL, NULL) != job_completed) return false;
+		scoreOn(V_c, gene_driver, condition_driver, replicate_results, replicate_scores);
+		for (unsigned int b=0; b<replicate_results.size(); b++)
+			null[p].push_back(make_pair(ranking_key(replicate_scores[b], by),
+			                            make_pair(replicate_results[b].getGeneCluster().size(), replicate_results[b].getConditionCluster().size())));
+		if (job.verbose) cout << "\tpermutation " << p + 1 << "/" << permutations << ": " << replicate_results.size() << " biclusters" << endl;
+	}
+	
+	//the p-value counts the permutations having a bicluster at least as large and as good
+	if (permutations > 0)
+		for (unsigned int b=0; b<results.size(); b++)
+		{
+			float key = ranking_key(scores[b], by);
+			unsigned int genes_number = results[b].getGeneCluster().size();
+			unsigned int conditions_number = results[b].getConditionCluster().size();
+			unsigned int better = 0;
+			for (unsigned int p=0; p<permutations; p++)
+				for (unsigned int k=0; k<null[p].size(); k++)
+					if (null[p][k].first <= key && null[p][k].second.first >= genes_number && null[p][k].second.second >= conditions_number)
+					{
+						better++;
+						break;
+					}
+			scores[b].p_value = (1.0 + better)/(1.0 + permutations);
+		}
+	
+	//bootstrap: conditions are drawn with replacement, and each bicluster is matched by gene set
+	vector<intvect> members(results.size());
+	for (unsigned int b=0; b<results.size(); b++) members[b] = results[b].getGeneCluster().getElements();
+	vector<double> stability(results.size(), 0.0);
+	vector<intvect> replicate_members;
+	vector<intvect> index(num_genes);
+	intvect drawn(num_conditions);
+	for (unsigned int r=0; r<bootstraps; r++)
+	{
+		Trace::Scope scope("bootstrap", "resample", "replicate", r);
+		random_generator rng(job.seed, job.runs_number + permutations + r);
+		for (unsigned int j=0; j<num_conditions; j++) drawn[j] = rng.value(num_conditions);
+		sort(drawn.begin(), drawn.end());
+		Matrix V_c = E_c.view(genes, drawn, intvect());
+		Matrix V_g = V_c.traspose();
+		Driver condition_view = (condition_driver.getRowsNumber() > 0) ? condition_driver.view(drawn) : Driver();
+		
+		replicate_results.clear();
+		replicate_found_at.clear();
+		if (sweep(replicate, V_g, V_c, gene_driver, condition_view, replicate_results, replicate_found_at, NULL, NULL) != job_completed) return false;
+		if (job.verbose) cout << "\tbootstrap " << r + 1 << "/" << bootstraps << ": " << replicate_results.size() << " biclusters" << endl;
+		
+		replicate_members.resize(replicate_results.size());
+		for (unsigned int i=0; i<num_genes; i++) index[i].clear();
+		for (unsigned int c=0; c<replicate_results.size(); c++)
+		{
+			replicate_members[c] = replicate_results[c].getGeneCluster().getElements();
+			for (unsigned int g=0; g<replicate_members[c].size(); g++) index[replicate_members[c][g]].push_back(c);
+		}
+		
+		//shared genes are counted through the gene to bicluster index
+		const long n = results.size();
+		#pragma omp parallel
+		{
+			vector<unsigned int> shared(replicate_results.size(), 0);
+			intvect touched;
+			
+			#pragma omp for schedule(dynamic, 16)
+			for (long b=0; b<n; b++)
+			{
+				touched.clear();
+				for (unsigned int g=0; g<members[b].size(); g++)
+					for (unsigned int k=0; k<index[members[b][g]].size(); k++)
+						if (shared[index[members[b][g]][k]]++ == 0) touched.push_back(index[members[b][g]][k]);
+				
+				double jaccard = 0.0;
+				for (unsigned int t=0; t<touched.size(); t++)
+				{
+					int c = touched[t];
+					jaccard = max(jaccard, (double) shared[c]/(members[b].size() + replicate_members[c].size() - shared[c]));
+					shared[c] = 0;
+				}
+				stability[b] += jaccard;
+			}
+		}
+	}
+	
+	if (bootstraps > 0)
+		for (unsigned int b=0; b<results.size(); b++)
+			scores[b].stability = stability[b]/bootstraps;
+	return true;
+}
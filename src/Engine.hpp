@@ -0,0 +1,575 @@
+//      Engine.hpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <string>
+#include <vector>
+
+#include "utilities.h"
+#include "Matrix.hpp"
+#include "Bicluster.hpp"
+#include "Driver.hpp"
+#include "Checkpoint.hpp"
+
+using namespace std;
+
+typedef vector<Bicluster> Biclustervect;
+typedef vector<unsigned long> cellvect;
+
+
+
+/**
+	\brief Parameters of a job, i.e. of a sweep of the (run, threshold) grid.
+*/
+
+struct JobConfig
+{
+	unsigned int runs_number; //number of random initial seeds
+	unsigned long seed; //random seed
+	float delta_reduce; //reduction threshold (AID parameter)
+	float delta_expand; //expansion threshold (AID parameter)
+	bool if_row_driver; //set if AID is performed on gene dimension
+	bool if_col_driver; //set if AID is performed on condition dimension
+	floatvect gene_thresholds; //empty for the default grid (\see Engine::thresholds)
+	floatvect condition_thresholds; //empty for the default grid
+	unsigned int batch_size; //number of cells iterated together
+	unsigned int shard; //the shard of the grid evaluated
+	unsigned int shards; //number of shards
+	bool reference; //set if the job runs on the fp32 reference matrices
+	string checkpoint_filename; //empty if no checkpoint is required
+	unsigned int checkpoint_interval; //seconds between two checkpoints
+	bool resume; //set if the job resumes the run saved in the checkpoint
+	float saturation; //the job stops once fewer new biclusters are expected from the next run, 0 to evaluate all the runs
+	double time_budget; //seconds given to the sweep, 0 for no deadline
+	Biclustervect warm_seeds; //initial signatures of the warm runs, evaluated before the random ones (\see Engine::run)
+	intvect gene_subset; //the genes the job runs on, empty for all of them
+	intvect condition_subset; //the conditions the job runs on, empty for all of them
+	bool verbose; //set if the progress of the job is printed on the standard output
+
+	JobConfig()
+		: runs_number(10), seed(0), delta_reduce(2.0), delta_expand(0.5), if_row_driver(false), if_col_driver(false), batch_size(1),
+		  shard(0), shards(1), reference(false), checkpoint_interval(300), resume(false), saturation(0.0), time_budget(0.0), verbose(false) {}
+};
+
+/**
+	\brief Discovery statistics of a job (\see Engine::run).
+
+	Each non-void bicluster found by a cell is an observation of a module. From the number of biclusters 
+	observed once (f1) and twice (f2) over R runs, the Good-Turing estimate of the new biclusters the next run 
+	would find is f1/R, and the Chao1 estimate of the biclusters not found yet is f1^2/(2 f2).
+*/
+
+struct JobStats
+{
+	unsigned int runs; //runs evaluated
+	unsigned long cells; //cells evaluated
+	unsigned long observations; //non-void biclusters found, either new or known
+	unsigned int singletons; //biclusters found once (f1)
+	unsigned int doubletons; //biclusters found twice (f2)
+	float expected_yield; //expected new biclusters of the next run
+	float unseen; //estimated biclusters not found yet
+	bool saturated; //set if the job stopped before its last run, since expected_yield fell below the saturation
+	bool expired; //set if the job stopped before its last cell, since its time budget elapsed
+
+	JobStats() : runs(0), cells(0), observations(0), singletons(0), doubletons(0), expected_yield(0.0), unseen(0.0), saturated(false), expired(false) {}
+};
+
+/**
+	\brief Quality scores of a bicluster (\see Engine::score).
+*/
+
+struct Quality
+{
+	float residue; //mean squared residue of the submatrix
+	float correlation; //mean absolute correlation between the gene profiles
+	float coherence; //mean correlation between the gene profiles and the condition signature, signed by the gene scores
+	float gene_distance; //mean distance between genes, -1 if no information is available
+	float condition_distance; //mean distance between conditions, -1 if no information is available
+	float p_value; //empirical p-value of the ranking score, -1 if not resampled (\see Engine::resample)
+	float stability; //mean best overlap with the biclusters of bootstrap replicates, -1 if not resampled
+
+	Quality() : residue(0.0), correlation(0.0), coherence(0.0), gene_distance(-1), condition_distance(-1), p_value(-1), stability(-1) {}
+};
+
+typedef vector<Quality> Qualityvect;
+
+/**
+	\brief Quality scores biclusters can be ranked by.
+*/
+
+enum quality_t { quality_residue, quality_correlation, quality_coherence, quality_gene_distance, quality_condition_distance };
+
+/**
+	\brief Outcome of a job.
+*/
+
+enum job_status_t { job_completed, job_interrupted, job_invalid, job_failed };
+
+
+
+/**
+	\brief Receiver of the biclusters found by a job, as soon as they are found.
+*/
+
+class ResultHandler {
+
+public:
+
+	virtual ~ResultHandler() {};
+
+/**
+	\brief Called for each new bicluster (void and known biclusters are not reported)
+
+	\param bicluster the bicluster
+	\param cell the grid cell where the bicluster was found
+*/
+	virtual void found(Bicluster& bicluster, unsigned long cell) = 0;
+
+/**
+	\brief Called after each batch: the job stops if it returns true
+
+	\return true if the job has to stop, false otherwise
+*/
+	virtual bool cancelled() { return false; }
+
+} ;
+
+
+
+/**
+	\brief Engine class.
+
+	The engine owns a data set (the normalized expression matrices and the drivers), which is loaded and
+	prepared once, and then runs any number of jobs on it.
+
+	The (run, condition threshold, gene threshold) grid is enumerated in this order:
+	cell k refers to run k/(C*G), condition threshold (k/G)%C and gene threshold k%G.
+	Cell k belongs to shard k%shards. The seed of run r is drawn from the stream r of the random seed,
+	so that shards agree on it without any communication.
+
+ */
+
+class Engine {
+
+private:
+
+	Matrix E; //raw data, until prepared
+	Matrix E_g; //transposed and normalized expression matrix
+	Matrix E_c; //normalized expression matrix
+	Matrix E_g_fp32; //reference matrices, kept only for validation
+	Matrix E_c_fp32;
+	Driver gene_driver;
+	Driver condition_driver;
+	shared_ptr<Driver> loaded_gene_driver; //the gene driver of all the genes, if they were filtered...
+	intvect kept_genes; //...and the loaded index of the genes kept
+	unsigned int num_loaded_genes;
+	unsigned int num_genes;
+	unsigned int num_conditions;
+
+	job_status_t sweep(const JobConfig& job, Matrix& E_g_job, Matrix& E_c_job, Driver& gene_driver_job, Driver& condition_driver_job,
+	                   Biclustervect& results, cellvect& found_at, ResultHandler* handler, JobStats* stats);
+	void scoreOn(Matrix& E_c_job, Driver& gene_driver_job, Driver& condition_driver_job, Biclustervect& results, Qualityvect& scores);
+
+public:
+
+/**
+	\brief Return an engine without data
+*/
+	Engine() : num_loaded_genes(0), num_genes(0), num_conditions(0) {};
+
+/**
+	\brief Load the expression matrix
+
+	\param filename filepath
+	\param out_of_core set if the file is binary and is streamed from disk rather than loaded
+	\return false if the file cannot be read, true otherwise
+*/
+	bool loadData(const string& filename, bool out_of_core);
+
+/**
+	\brief Load a sparse expression matrix (\see Matrix::loadSparseFromFile)
+
+	\param filename filepath
+	\return false if the file cannot be read, true otherwise
+*/
+	bool loadSparseData(const string& filename);
+
+/**
+	\brief Load the distance matrix for the gene dimension, as a further source of the gene driver (\see Driver::addSource)
+
+	\param filename filepath
+	\return false if the file provides no distances, true otherwise
+*/
+	bool loadGeneDriver(const string& filename);
+
+/**
+	\brief Load the distance matrix for the condition dimension, as a further source of the condition driver
+
+	\param filename filepath
+	\return false if the file provides no distances, true otherwise
+*/
+	bool loadConditionDriver(const string& filename);
+
+/**
+	\brief Load a source of additional information for the gene dimension.
+
+	The source is a filepath, optionally prefixed by its kind: distances:, annotations: or embeddings:.
+
+	\param source the source
+	\param kind the kind of a source without prefix (distances, annotations or embeddings)
+	\param cache_bytes size of the distance rows cache, for annotations
+	\param metric distance between embeddings
+	\return false if the file provides no information or its objects differ from those of the other sources, true otherwise
+*/
+	bool loadGeneSource(const string& source, const string& kind, size_t cache_bytes, metric_t metric);
+
+/**
+	\brief Load a source of additional information for the condition dimension (\see loadGeneSource)
+
+	\param source the source
+	\param kind the kind of a source without prefix (distances, annotations or embeddings)
+	\param cache_bytes size of the distance rows cache, for annotations
+	\param metric distance between embeddings
+	\return false if the file provides no information or its objects differ from those of the other sources, true otherwise
+*/
+	bool loadConditionSource(const string& source, const string& kind, size_t cache_bytes, metric_t metric);
+
+/**
+	\brief Return the number of sources of the gene driver
+
+	\return number of sources
+*/
+	unsigned int getGeneSourcesNumber();
+
+/**
+	\brief Return the number of sources of the condition driver
+
+	\return number of sources
+*/
+	unsigned int getConditionSourcesNumber();
+
+/**
+	\brief Set how the sources of the gene driver are fused (\see Driver::weighSources)
+
+	\param weights the weight of each source, in loading order
+	\param missing the distance replacing -1 in each source, negative if the source is skipped
+	\return false if the number of sources differs, true otherwise
+*/
+	bool weighGeneSources(const floatvect& weights, const floatvect& missing);
+
+/**
+	\brief Set how the sources of the condition driver are fused (\see Driver::weighSources)
+
+	\param weights the weight of each source, in loading order
+	\param missing the distance replacing -1 in each source, negative if the source is skipped
+	\return false if the number of sources differs, true otherwise
+*/
+	bool weighConditionSources(const floatvect& weights, const floatvect& missing);
+
+/**
+	\brief Parse how n sources are fused.
+
+	\param weights_list comma separated weights, empty if all the weights are 1
+	\param missing_list comma separated distances replacing -1, or skip; empty if all the sources are skipped
+	\param n the number of sources
+	\param weights the weight of each source
+	\param missing the distance replacing -1 in each source, negative if the source is skipped
+	\return false if the lists are malformed or longer than n, true otherwise
+*/
+	static bool parseFusion(const string& weights_list, const string& missing_list, unsigned int n, floatvect& weights, floatvect& missing);
+
+/**
+	\brief Split the kind prefix of a source from its filepath
+
+	\param filename the source, then its filepath
+	\param kind the kind, set only if the source has a prefix
+*/
+	static void parseSource(string& filename, string& kind);
+
+/**
+	\brief Load the annotations of the genes, from which distances are computed on demand (\see Driver::loadAnnotationsFromFile)
+
+	\param filename filepath
+	\param cache_bytes size of the distance rows cache
+	\return false if the file provides no annotations, true otherwise
+*/
+	bool loadGeneAnnotations(const string& filename, size_t cache_bytes);
+
+/**
+	\brief Load the annotations of the conditions, from which distances are computed on demand
+
+	\param filename filepath
+	\param cache_bytes size of the distance rows cache
+	\return false if the file provides no annotations, true otherwise
+*/
+	bool loadConditionAnnotations(const string& filename, size_t cache_bytes);
+
+/**
+	\brief Load the embeddings of the genes, from which distances are computed on demand (\see Driver::loadEmbeddingsFromFile)
+
+	\param filename filepath
+	\param metric distance between embeddings
+	\return false if the file provides no embeddings, true otherwise
+*/
+	bool loadGeneEmbeddings(const string& filename, metric_t metric);
+
+/**
+	\brief Load the embeddings of the conditions, from which distances are computed on demand
+
+	\param filename filepath
+	\param metric distance between embeddings
+	\return false if the file provides no embeddings, true otherwise
+*/
+	bool loadConditionEmbeddings(const string& filename, metric_t metric);
+
+/**
+	\brief Index the drivers computed on demand, so that clusters are expanded approximately (\see Driver::buildIndex)
+
+	\param recall target fraction of the objects retrieved by each expansion, in (0, 1)
+	\param validate set if each expansion is compared with the exact one
+	\return the number of drivers indexed
+*/
+	unsigned int indexDrivers(float recall, bool validate);
+
+/**
+	\brief Return a summary of the expansions performed through the indices, one line for each driver
+
+	\return the summary, empty if no driver is indexed
+*/
+	string indexReport();
+
+/**
+	\brief Drop the genes whose expression varies least, before normalization (\see prepare).
+
+	Genes whose variance is below min_variance are dropped, and so are the fraction variance_quantile of the genes 
+	having the lowest variance and the fraction expression_quantile of those having the lowest mean expression (ties 
+	are broken by index): a gene is kept only if it passes all the filters. The matrix is compacted in place, and the 
+	gene driver becomes a view of the kept genes (\see Driver::view), which is indexed as the loaded driver (\see 
+	indexDrivers). From then on, the engine only knows the kept genes, in their loaded order: getKeptGenes maps them 
+	back to the loaded ones.
+
+	\param min_variance the lowest variance of a kept gene
+	\param variance_quantile the fraction of genes dropped by variance, in [0, 1)
+	\param expression_quantile the fraction of genes dropped by mean expression, in [0, 1)
+	\return false if the matrix cannot be filtered (sparse or out-of-core matrices) or no gene would be kept, true otherwise
+*/
+	bool filterGenes(float min_variance, float variance_quantile, float expression_quantile);
+
+/**
+	\brief Return the loaded index of each gene (\see filterGenes)
+
+	\return the indices, empty if the genes have not been filtered
+*/
+	const intvect& getKeptGenes();
+
+/**
+	\brief Return the number of genes loaded, including those filtered (\see filterGenes)
+
+	\return number of genes loaded
+*/
+	unsigned int getLoadedGenesNumber();
+
+/**
+	\brief Return the header line of the partial results of a job (\see the merge subcommand).
+
+	After the data size and the shard, it lists the parameters that all the shards of a run must share: the random
+	seed, the runs (warm ones included), the threshold pairs of each run, the AID deltas and the drivers used.
+
+	\param job the job parameters
+	\return the header line
+*/
+	string partialHeader(const JobConfig& job);
+
+/**
+	\brief Normalize the expression matrix, store it in the given precision and release the raw data.
+
+	ISA shows best performance on normalized matrices, one for the gene signature evaluation and
+	one for the condition signature evaluation.
+
+	\param precision storage format of the normalized matrices
+	\param keep_reference set if fp32 copies are kept for reference jobs
+	\param accumulation accumulator of the matrix products
+*/
+	void prepare(precision_t precision, bool keep_reference, scalar_t accumulation = scalar_fp32);
+
+/**
+	\brief Return the number of genes
+
+	\return number of genes
+*/
+	unsigned int getGenesNumber();
+
+/**
+	\brief Return the number of conditions
+
+	\return number of conditions
+*/
+	unsigned int getConditionsNumber();
+
+/**
+	\brief Run a job, collecting the biclusters found in the grid cells of its shard.
+
+	Void biclusters are discarded, and each bicluster is reported only once, in the order it is found.
+	If batch_size is greater than one, batch_size cells are iterated together, so that the
+	matrices are read once for all of them.
+
+	If a checkpoint is required, the cells it marks as evaluated are skipped, and a snapshot is saved
+	after each batch once its interval elapsed. The job stops after the current batch if termination is
+	requested (\see Checkpoint::terminationRequested) or the handler cancels it.
+	
+	Warm seeds (e.g., the biclusters of a previous analysis, mapped onto the data set) are evaluated as the first 
+	runs, each of them on a single threshold pair: the one whose signatures, one iteration after the seed, are the 
+	most similar to it. Being close to fixed points, their trajectories converge in a few iterations. The random 
+	runs follow, drawing the same seeds as they would without warm runs. A checkpoint records the number of warm 
+	seeds only, so that a job has to be resumed with the same ones.
+	
+	If subsets of genes or conditions are given, the job runs on views of the matrices and drivers (\see Matrix::view,
+	Driver::view), which read the entries of the data set in place: the data are neither copied nor normalized again.
+	Biclusters (including those passed to the handler) and warm seeds refer to the data set, i.e. they are mapped 
+	from and to the subset.
+	
+	If a saturation is given, batches do not cross runs, and the job completes as soon as, after two runs at 
+	least, fewer new biclusters than the saturation are expected from the next run (\see JobStats), reporting 
+	the statistics of each run. The stopping point depends on the results only, so that it is the same for any 
+	batch size and number of threads.
+
+	If a time budget is given, batches do not cross runs either, and the cells of each run are evaluated from the 
+	threshold pairs that found the most new biclusters per cell in the previous runs, so that the most productive 
+	cells come first. Once the budget elapses, the trajectories still iterating are abandoned (their cells are 
+	evaluated again if the job is resumed, the checkpoint being saved at once) and the job completes with the 
+	biclusters found so far.
+
+	\param job the job parameters
+	\param results the biclusters
+	\param found_at the grid cell where each bicluster was found
+	\param handler receiver of the biclusters, as they are found (NULL if not required)
+	\param stats the discovery statistics (NULL if not required); runs and estimates refer to unsharded jobs
+	\return job_completed, job_interrupted if termination was requested or the job was cancelled, job_invalid
+	        if the job needs a driver that was not loaded, has no thresholds, the checkpoint refers to another run, 
+	        a saturation is given to a sharded or checkpointed job, a warm seed does not fit the data set, or a subset 
+	        is not a list of distinct genes (conditions) of the data set, or it cannot be viewed (sparse or out-of-core 
+	        matrices), job_failed if the rows of an out-of-core matrix cannot be mapped (the biclusters found so far 
+	        are returned, and saved in the checkpoint)
+*/
+	job_status_t run(const JobConfig& job, Biclustervect& results, cellvect& found_at, ResultHandler* handler = NULL, JobStats* stats = NULL);
+
+/**
+	\brief Return the thresholds evaluated for each seed.
+
+	\param gene_thresholds the G gene thresholds
+	\param condition_thresholds the C condition thresholds
+*/
+	static void thresholds(floatvect& gene_thresholds, floatvect& condition_thresholds);
+
+/**
+	\brief Add a bicluster to the results, unless it is void or already known
+
+	\param results the biclusters found so far
+	\param found_at the grid cell where each bicluster was found
+	\param signature the bicluster
+	\param cell the grid cell where the bicluster was found
+	\param position set to the position of the bicluster in the results, either new or known (NULL if not required)
+	\return true if the bicluster was added, false otherwise
+*/
+	static bool collect(Biclustervect& results, cellvect& found_at, Bicluster& signature, unsigned long cell, unsigned int* position = NULL);
+
+/**
+	\brief Merge near-duplicate biclusters, keeping the first bicluster of each group.
+
+	The overlap of two biclusters is the Jaccard index of their (gene, condition) cells, which is at most the Jaccard
+	index of their gene sets. Candidates are then enumerated through a gene to bicluster inverted index, restricted to
+	the rarest genes of each bicluster, of which a pair reaching the overlap must share two (prefix filtering). Groups are the
+	connected components of the pairs whose overlap is at least the given one, so that the result does not depend on
+	the number of threads.
+
+	\param results the biclusters, in the order they were found
+	\param found_at the grid cell where each bicluster was found
+	\param overlap the smallest overlap of merged biclusters, in (0, 1]
+	\return the number of biclusters merged into others
+*/
+	static unsigned int consolidate(Biclustervect& results, cellvect& found_at, float overlap);
+
+/**
+	\brief Return the quality scores of each bicluster, evaluated on the normalized data.
+
+	Biclusters are scored in parallel. Each of them reads only its submatrix and the distances between its
+	members, through the gather kernels of the matrix and of the drivers (\see Matrix::gather, Driver::gather).
+	Correlations are 0 when undefined, e.g. for a single gene or a constant profile.
+
+	\param results the biclusters
+	\param scores the scores, one for each bicluster
+*/
+	void score(Biclustervect& results, Qualityvect& scores);
+
+/**
+	\brief Keep the k best biclusters by a quality score, best first (ties keep the order they were found in).
+
+	A bounded heap of k biclusters is filled in a single pass. Residue and distances are better when lower,
+	correlation and coherence when higher; a distance that is not available is the worst.
+
+	\param results the biclusters
+	\param found_at the grid cell where each bicluster was found
+	\param scores the scores of each bicluster
+	\param by the ranking score
+	\param k the number of biclusters kept
+*/
+	static void selectTop(Biclustervect& results, cellvect& found_at, Qualityvect& scores, quality_t by, unsigned int k);
+
+/**
+	\brief Attach to each bicluster an empirical p-value and a stability, by running the job on resampled data.
+
+	Resampled data are views of the normalized matrix (\see Matrix::view), so that nothing is reloaded, copied or
+	normalized again. Each replicate evaluates the whole grid of the job from the same seeds (without saturation or 
+	time budget, so that the runs of a saturated or expired job should be set to those it evaluated); the random 
+	choices of replicate k are drawn from the stream runs + k of the job seed.
+
+	- Permutations rotate the profile of each gene by a random shift, keeping its values but breaking its correlation
+	  with the other genes. The p-value of a bicluster is (1 + P')/(1 + P), P' being the number of the P permutations
+	  having a bicluster at least as large (in both dimensions) and at least as good by the ranking score: small
+	  biclusters, which are coherent by chance, are then compared only with the null biclusters they could be.
+	- Bootstrap replicates draw the conditions with replacement (condition drivers are viewed accordingly). The
+	  stability of a bicluster is the mean, over the replicates, of the largest Jaccard index between its gene set and
+	  those of the biclusters of the replicate.
+
+	\param job the job
+	\param results the biclusters found by the job
+	\param scores their scores (\see score), where p-values and stabilities are set
+	\param permutations the number of permutations (0 for no p-value)
+	\param bootstraps the number of bootstrap replicates (0 for no stability)
+	\param by the ranking score
+	\return false if the data cannot be viewed (sparse or out-of-core matrices), the job runs on a subset or a replicate 
+	        is not completed (its biclusters would be partial), true otherwise
+*/
+	bool resample(const JobConfig& job, Biclustervect& results, Qualityvect& scores, unsigned int permutations, unsigned int bootstraps, quality_t by);
+
+/**
+	\brief Return the quality score named s
+
+	\param s the name (residue, correlation, coherence, gene_distance, condition_distance)
+	\param q the score
+	\return false if the name is unknown, true otherwise
+*/
+	static bool parseQuality(const string& s, quality_t& q);
+
+} ;
+
+#endif
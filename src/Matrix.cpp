@@ -19,6 +19,448 @@
 
 
 #include "Matrix.hpp"
+#include "Trace.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//--------------------- reduced precision formats ---------------------
+
+static inline float bits_to_float(uint32_t u)
+{
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+static inline uint32_t float_to_bits(float f)
+{
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+static inline float bf16_to_float(uint16_t h)
+{
+	return bits_to_float(((uint32_t)h) << 16);
+}
+
+static inline uint16_t float_to_bf16(float f)
+{
+	uint32_t u = float_to_bits(f);
+	if ((u & 0x7fffffff) > 0x7f800000) return (u >> 16) | 0x0040; //quiet NaN
+	u += 0x7fff + ((u >> 16) & 1); //round to nearest even
+	return u >> 16;
+}
+
+//branch-free, so that it can be vectorized: subnormals are rescaled by the multiplication
+static inline float fp16_to_float(uint16_t h)
+{
+	float f = bits_to_float(((uint32_t)(h & 0x7fff)) << 13) * 5.192296858534828e+33f; //2^112, exponent adjust
+	uint32_t u = float_to_bits(f);
+	u |= (f >= 65536.0f) ? (255u << 23) : 0u; //Inf/NaN survive
+	u |= ((uint32_t)(h & 0x8000)) << 16;
+	return bits_to_float(u);
+}
+
+static inline uint16_t float_to_fp16(float f)
+{
+	uint32_t u = float_to_bits(f);
+	uint16_t sign = (u >> 16) & 0x8000;
+	u &= 0x7fffffff;
+	
+	if (u >= 0x47800000) return sign | (u > 0x7f800000 ? 0x7e00 : 0x7c00); //overflow and NaN
+	if (u < 0x38800000) return sign | (uint16_t) lrintf(bits_to_float(u)*16777216.0f); //subnormal, in units of 2^-24
+	
+	uint32_t mant_odd = (u >> 13) & 1;
+	u += 0xc8000fff + mant_odd; //exponent rebias and round to nearest even
+	return sign | (u >> 13);
+}
+
+//----------------------------- kernels -------------------------------
+
+//storage backends: the stored type of the entries, how they are decoded and scaled
+struct fp32_storage
+{
+	typedef float stored;
+	static inline float decode(float x) { return x; }
+	static inline float scale(float v, const float*, long) { return v; }
+};
+
+struct bf16_storage
+{
+	typedef uint16_t stored;
+	static inline float decode(uint16_t x) { return bf16_to_float(x); }
+	static inline float scale(float v, const float*, long) { return v; }
+};
+
+struct fp16_storage
+{
+	typedef uint16_t stored;
+	static inline float decode(uint16_t x) { return fp16_to_float(x); }
+	static inline float scale(float v, const float*, long) { return v; }
+};
+
+struct int8_storage
+{
+	typedef int8_t stored;
+	static inline float decode(int8_t x) { return x; }
+	static inline float scale(float v, const float* row_scale, long i) { return v*row_scale[i]; }
+};
+
+template<typename Storage, typename Scalar>
+static inline Scalar dot(const typename Storage::stored* row, const float* v, int n)
+{
+	Scalar acc = 0.0;
+	#pragma omp simd reduction(+:acc)
+	for (int j=0; j<n; j++)
+		acc += (Scalar) Storage::decode(row[j])*v[j];
+	return acc;
+}
+
+//each row is read once for all the vectors
+template<typename Storage, typename Scalar>
+static void dense_kernel(const void* entries, const float* row_scale, long r, int c, const floatmatrix& in, floatmatrix& out)
+{
+	const typename Storage::stored* e = (const typename Storage::stored*) entries;
+	const int nv = in.size();
+	
+	#pragma omp parallel
+	{
+		const double start = Trace::enabled() ? Trace::now() : 0.0;
+		#pragma omp for schedule(static)
+		for (long i=0; i<r; i++)
+		{
+			const typename Storage::stored* row = e + (size_t)i*c;
+			for (int b=0; b<nv; b++)
+				out[b][i] = Storage::scale(dot<Storage, Scalar>(row, &in[b][0], c), row_scale, i);
+		}
+		if (Trace::enabled()) Trace::record("dense product", "kernel", start, "vectors", nv);
+	}
+}
+
+//both directions gather: the traspose reads the entries by column
+template<typename Scalar>
+static void sparse_kernel(const uint64_t* begin, const uint32_t* index, const float* values, long r, const floatmatrix& in, floatmatrix& out)
+{
+	const int nv = in.size();
+	
+	#pragma omp parallel
+	{
+		const double start = Trace::enabled() ? Trace::now() : 0.0;
+		#pragma omp for schedule(dynamic, 256)
+		for (long i=0; i<r; i++)
+			for (int b=0; b<nv; b++)
+			{
+				const float* x = &in[b][0];
+				Scalar sum = 0.0;
+				for (uint64_t k=begin[i]; k<begin[i + 1]; k++)
+					sum += (Scalar) values[k]*x[index[k]];
+				out[b][i] = sum;
+			}
+		if (Trace::enabled()) Trace::record("sparse product", "kernel", start, "vectors", nv);
+	}
+}
+
+//a block of stored rows of an out-of-core matrix
+template<typename Scalar>
+static void file_kernel(const float* data, long first, long last, size_t c, const floatmatrix& in, floatmatrix& out)
+{
+	const int nv = in.size();
+	
+	#pragma omp parallel for schedule(static)
+	for (long i=first; i<last; i++)
+		for (int b=0; b<nv; b++)
+			out[b][i] = dot<fp32_storage, Scalar>(data + (i - first)*c, &in[b][0], c);
+}
+
+//dispatch tables, indexed by storage format and accumulator
+typedef void (*dense_kernel_t)(const void*, const float*, long, int, const floatmatrix&, floatmatrix&);
+static const dense_kernel_t dense_kernels[4][2] = {
+	{ dense_kernel<fp32_storage, float>, dense_kernel<fp32_storage, double> },
+	{ dense_kernel<bf16_storage, float>, dense_kernel<bf16_storage, double> },
+	{ dense_kernel<fp16_storage, float>, dense_kernel<fp16_storage, double> },
+	{ dense_kernel<int8_storage, float>, dense_kernel<int8_storage, double> }
+};
+
+typedef void (*sparse_kernel_t)(const uint64_t*, const uint32_t*, const float*, long, const floatmatrix&, floatmatrix&);
+static const sparse_kernel_t sparse_kernels[2] = { sparse_kernel<float>, sparse_kernel<double> };
+
+typedef void (*file_kernel_t)(const float*, long, long, size_t, const floatmatrix&, floatmatrix&);
+static const file_kernel_t file_kernels[2] = { file_kernel<float>, file_kernel<double> };
+
+//gather kernels: the entries of a submatrix, read in the storage format and decoded
+template<typename Storage>
+static void dense_gather(const void* entries, const float* row_scale, size_t c, const intvect& row_index, const intvect& col_index, float* out)
+{
+	const typename Storage::stored* e = (const typename Storage::stored*) entries;
+	const size_t nc = col_index.size();
+	for (size_t r=0; r<row_index.size(); r++)
+	{
+		const long i = row_index[r];
+		const typename Storage::stored* row = e + (size_t)i*c;
+		for (size_t k=0; k<nc; k++)
+			out[r*nc + k] = Storage::scale(Storage::decode(row[col_index[k]]), row_scale, i);
+	}
+}
+
+typedef void (*dense_gather_t)(const void*, const float*, size_t, const intvect&, const intvect&, float*);
+static const dense_gather_t dense_gathers[4] = { dense_gather<fp32_storage>, dense_gather<bf16_storage>, dense_gather<fp16_storage>, dense_gather<int8_storage> };
+
+//------------------------------- views --------------------------------
+
+struct matrix_view
+{
+	const void* entries; //row-major entries of the viewed matrix...
+	const float* row_scale; //...their int8 scales...
+	size_t stride; //...and its number of columns
+	precision_t precision;
+	intvect rows; //entry (r, k) is entry (rows[r], cols[(k + shifts[r]) % cols.size()]) of the viewed matrix
+	intvect cols;
+	intvect shifts; //empty if rows are not rotated
+	
+	size_t shift(size_t r) const
+	{
+		return shifts.empty() ? 0 : shifts[r];
+	}
+	
+	float get(size_t r, size_t k) const
+	{
+		size_t t = (size_t)rows[r]*stride + cols[(k + shift(r)) % cols.size()];
+		switch (precision)
+		{
+			case precision_bf16: return bf16_to_float(((const uint16_t*) entries)[t]);
+			case precision_fp16: return fp16_to_float(((const uint16_t*) entries)[t]);
+			case precision_int8: return ((const int8_t*) entries)[t]*row_scale[rows[r]];
+			default: return ((const float*) entries)[t];
+		}
+	}
+};
+
+//each row of the view gathers its columns from a row of the viewed matrix: column t is read for the entry (t - s) mod n of a vector
+template<typename Storage, typename Scalar>
+static void view_kernel(const matrix_view& v, const floatmatrix& in, floatmatrix& out)
+{
+	const typename Storage::stored* e = (const typename Storage::stored*) v.entries;
+	const int* cols = v.cols.data();
+	const long r = v.rows.size();
+	const size_t n = v.cols.size();
+	const int nv = in.size();
+	
+	#pragma omp parallel
+	{
+		const double start = Trace::enabled() ? Trace::now() : 0.0;
+		#pragma omp for schedule(static)
+		for (long i=0; i<r; i++)
+		{
+			const typename Storage::stored* row = e + (size_t)v.rows[i]*v.stride;
+			const size_t s = v.shift(i);
+			for (int b=0; b<nv; b++)
+			{
+				const float* x = &in[b][0];
+				Scalar sum = 0.0;
+				for (size_t t=s; t<n; t++) sum += (Scalar) Storage::decode(row[cols[t]])*x[t - s];
+				for (size_t t=0; t<s; t++) sum += (Scalar) Storage::decode(row[cols[t]])*x[t + n - s];
+				out[b][i] = Storage::scale(sum, v.row_scale, v.rows[i]);
+			}
+		}
+		if (Trace::enabled()) Trace::record("view product", "kernel", start, "vectors", nv);
+	}
+}
+
+//the columns of the view: fixed chunks of rows accumulate their weighted rows, and chunks are merged in order
+template<typename Storage, typename Scalar>
+static void view_traspose_kernel(const matrix_view& v, const floatmatrix& in, floatmatrix& out)
+{
+	const typename Storage::stored* e = (const typename Storage::stored*) v.entries;
+	const int* cols = v.cols.data();
+	const long r = v.rows.size();
+	const size_t n = v.cols.size();
+	const int nv = in.size();
+	const long chunk = 1024;
+	const long chunks = (r + chunk - 1)/chunk;
+	vector< vector<Scalar> > partial(chunks, vector<Scalar>((size_t)nv*n, 0.0));
+	
+	#pragma omp parallel
+	{
+		const double start = Trace::enabled() ? Trace::now() : 0.0;
+		#pragma omp for schedule(static)
+		for (long c=0; c<chunks; c++)
+			for (long i=c*chunk; i<min(r, (c + 1)*chunk); i++)
+			{
+				const typename Storage::stored* row = e + (size_t)v.rows[i]*v.stride;
+				const size_t s = v.shift(i);
+				const Scalar scale = Storage::scale(1.0, v.row_scale, v.rows[i]);
+				for (int b=0; b<nv; b++)
+				{
+					const Scalar w = in[b][i]*scale;
+					if (w == 0.0) continue; //signatures are mostly zero
+					Scalar* o = &partial[c][(size_t)b*n];
+					for (size_t t=s; t<n; t++) o[t - s] += w*Storage::decode(row[cols[t]]);
+					for (size_t t=0; t<s; t++) o[t + n - s] += w*Storage::decode(row[cols[t]]);
+				}
+			}
+		if (Trace::enabled()) Trace::record("view traspose product", "kernel", start, "vectors", nv);
+	}
+	
+	for (int b=0; b<nv; b++)
+		for (size_t k=0; k<n; k++)
+		{
+			Scalar sum = 0.0;
+			for (long c=0; c<chunks; c++) sum += partial[c][(size_t)b*n + k];
+			out[b][k] = sum;
+		}
+}
+
+typedef void (*view_kernel_t)(const matrix_view&, const floatmatrix&, floatmatrix&);
+static const view_kernel_t view_kernels[2][4][2] = {
+	{
+		{ view_kernel<fp32_storage, float>, view_kernel<fp32_storage, double> },
+		{ view_kernel<bf16_storage, float>, view_kernel<bf16_storage, double> },
+		{ view_kernel<fp16_storage, float>, view_kernel<fp16_storage, double> },
+		{ view_kernel<int8_storage, float>, view_kernel<int8_storage, double> }
+	},
+	{
+		{ view_traspose_kernel<fp32_storage, float>, view_traspose_kernel<fp32_storage, double> },
+		{ view_traspose_kernel<bf16_storage, float>, view_traspose_kernel<bf16_storage, double> },
+		{ view_traspose_kernel<fp16_storage, float>, view_traspose_kernel<fp16_storage, double> },
+		{ view_traspose_kernel<int8_storage, float>, view_traspose_kernel<int8_storage, double> }
+	}
+};
+
+//--------------------------- out-of-core -----------------------------
+
+static const char matrix_file_magic[8] = {'A', 'I', 'D', '-', 'I', 'S', 'A', '1'};
+
+struct matrix_file_header
+{
+	char magic[8];
+	uint32_t rows;
+	uint32_t cols;
+	double mean;
+	double variance;
+};
+
+struct matrix_file
+{
+	int fd;
+	matrix_file_header header;
+	
+	matrix_file() : fd(-1) {}
+	~matrix_file() { if (fd >= 0) close(fd); }
+	
+	off_t offset(size_t row)
+	{
+		return sizeof(header) + (off_t)row*header.cols*sizeof(float);
+	}
+	
+	//it maps the stored rows [first, last), or returns NULL if they cannot be mapped; base and length are needed to unmap them
+	const float* map(size_t first, size_t last, void*& base, size_t& length)
+	{
+		off_t begin = offset(first);
+		off_t aligned = begin - begin % sysconf(_SC_PAGESIZE);
+		length = offset(last) - aligned;
+		base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, aligned);
+		if (base == MAP_FAILED) return NULL;
+		madvise(base, length, MADV_SEQUENTIAL);
+		return (const float*) ((char*) base + (begin - aligned));
+	}
+	
+	void read_ahead(size_t first, size_t last)
+	{
+		posix_fadvise(fd, offset(first), offset(last) - offset(first), POSIX_FADV_WILLNEED);
+	}
+};
+
+//------------------------------ sparse -------------------------------
+
+typedef vector<uint32_t, placed_allocator<uint32_t> > placed_indexvect;
+typedef vector<uint64_t, placed_allocator<uint64_t> > placed_offsetvect;
+
+struct sparse_entries
+{
+	uint32_t rows;
+	uint32_t cols;
+	placed_offsetvect row_begin; //CSR: entries of row i are in [row_begin[i], row_begin[i+1])
+	placed_indexvect row_cols;
+	placed_floatvect row_values;
+	placed_offsetvect col_begin; //CSC: entries of column j are in [col_begin[j], col_begin[j+1])
+	placed_indexvect col_rows;
+	placed_floatvect col_values;
+	double sum; //sum of the entries...
+	double squares; //...and of their squares
+	
+	float get(size_t i, size_t j)
+	{
+		placed_indexvect::iterator first = row_cols.begin() + row_begin[i];
+		placed_indexvect::iterator last = row_cols.begin() + row_begin[i + 1];
+		placed_indexvect::iterator it = lower_bound(first, last, (uint32_t) j);
+		return (it != last && *it == j) ? row_values[it - row_cols.begin()] : 0.0;
+	}
+};
+
+//it reads a Matrix Market coordinate file, or a 0-based triplet file
+static bool read_triplets(istream& is, uint32_t& rows, uint32_t& cols, vector<uint32_t>& r, vector<uint32_t>& c, floatvect& v)
+{
+	string line;
+	bool market = false;
+	bool pattern = false;
+	bool symmetric = false;
+	size_t declared = 0;
+	rows = 0;
+	cols = 0;
+	
+	if (is.peek() == '%')
+	{
+		getline(is, line);
+		istringstream banner(line);
+		string tag, object, format, field, symmetry;
+		banner >> tag >> object >> format >> field >> symmetry;
+		if (tag != "%%MatrixMarket" || object != "matrix" || format != "coordinate") return false;
+		if (field == "complex" || (symmetry != "general" && symmetry != "symmetric")) return false;
+		market = true;
+		pattern = (field == "pattern");
+		symmetric = (symmetry == "symmetric");
+		
+		while (getline(is, line) && (line.empty() || line[0] == '%'));
+		istringstream size(line);
+		if (!(size >> rows >> cols >> declared)) return false;
+		r.reserve(declared);
+		c.reserve(declared);
+		v.reserve(declared);
+	}
+	
+	while (getline(is, line))
+	{
+		if (line.empty() || line[0] == '%' || line[0] == '#') continue;
+		istringstream entry(line);
+		long i, j;
+		float value = 1.0;
+		if (!(entry >> i >> j) || (!pattern && !(entry >> value))) return false;
+		if (market) { i--; j--; }
+		if (i < 0 || j < 0 || (market && (i >= rows || j >= cols))) return false;
+		
+		r.push_back(i);
+		c.push_back(j);
+		v.push_back(value);
+		if (symmetric && i != j)
+		{
+			r.push_back(j);
+			c.push_back(i);
+			v.push_back(value);
+		}
+		if (!market)
+		{
+			rows = max(rows, (uint32_t) i + 1);
+			cols = max(cols, (uint32_t) j + 1);
+		}
+	}
+	return !market || r.size() >= declared;
+}
+
+//---------------------------------------------------------------------
 
 floatvect Matrix::readRow(string row) 
 {
@@ -29,13 +471,26 @@ floatvect Matrix::readRow(string row)
   return retval;
 }
 
-floatmatrix Matrix::readVector(istream &is) 
+void Matrix::readVector(istream &is) 
 {
   string line;
-  floatmatrix retval;
+  m.clear();
+  rows = 0;
+  cols = 0;
   while (getline(is, line))
-    retval.push_back(readRow(line));
-  return retval;
+  {
+    floatvect row = readRow(line);
+    if (row.empty()) continue; //blank lines carry no row
+    if (rows == 0) cols = row.size();
+    if (row.size() != cols)
+    {
+      //a ragged row would shift every following value, so the whole file is rejected
+      clear();
+      return;
+    }
+    m.insert(m.end(), row.begin(), row.end());
+    rows++;
+  }
 }
 
 
@@ -46,58 +501,322 @@ void Matrix::loadFromFile(char* filename)
 	istream is(&fb);
 	if (!is) return;
 	
-	m = readVector(is);
+	readVector(is);
 		
 	fb.close();
 	return;
 }
 
 
+void Matrix::mapFromFile(char* filename) 
+{
+	shared_ptr<matrix_file> f(new matrix_file());
+	f->fd = open(filename, O_RDONLY);
+	if (f->fd < 0) return;
+	
+	if (pread(f->fd, &f->header, sizeof(f->header), 0) != sizeof(f->header)) return;
+	if (memcmp(f->header.magic, matrix_file_magic, sizeof(matrix_file_magic)) != 0) return;
+	
+	struct stat st;
+	if (fstat(f->fd, &st) != 0 || st.st_size != f->offset(f->header.rows)) return;
+	posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	
+	*this = Matrix();
+	file = f;
+	rows = f->header.rows;
+	cols = f->header.cols;
+}
+
+
+void Matrix::loadSparseFromFile(char* filename) 
+{
+	ifstream is(filename);
+	if (!is) return;
+	
+	shared_ptr<sparse_entries> e(new sparse_entries());
+	vector<uint32_t> r, c;
+	floatvect v;
+	if (!read_triplets(is, e->rows, e->cols, r, c, v) || e->rows == 0 || e->cols == 0) return;
+	
+	//entries are bucketed by row, then each row is sorted by column, and repeated entries are summed
+	const long n_rows = e->rows;
+	vector<uint64_t> begin(n_rows + 1, 0);
+	for (size_t k=0; k<r.size(); k++) begin[r[k] + 1]++;
+	for (long i=0; i<n_rows; i++) begin[i + 1] += begin[i];
+	
+	vector< pair<uint32_t, float> > bucket(r.size());
+	vector<uint64_t> next(begin.begin(), begin.end() - 1);
+	for (size_t k=0; k<r.size(); k++) bucket[next[r[k]]++] = make_pair(c[k], v[k]);
+	vector<uint32_t>().swap(r);
+	vector<uint32_t>().swap(c);
+	floatvect().swap(v);
+	
+	vector<uint64_t> length(n_rows, 0);
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (long i=0; i<n_rows; i++)
+	{
+		if (begin[i] == begin[i + 1]) continue;
+		sort(bucket.begin() + begin[i], bucket.begin() + begin[i + 1]);
+		uint64_t last = begin[i];
+		for (uint64_t k=begin[i] + 1; k<begin[i + 1]; k++)
+		{
+			if (bucket[k].first == bucket[last].first) bucket[last].second += bucket[k].second;
+			else bucket[++last] = bucket[k];
+		}
+		length[i] = last + 1 - begin[i];
+	}
+	
+	e->row_begin.assign(n_rows + 1, 0);
+	for (long i=0; i<n_rows; i++) e->row_begin[i + 1] = e->row_begin[i] + length[i];
+	const uint64_t nnz = e->row_begin[n_rows];
+	e->row_cols.resize(nnz);
+	e->row_values.resize(nnz);
+	e->sum = 0.0;
+	e->squares = 0.0;
+	for (long i=0; i<n_rows; i++)
+		for (uint64_t k=0; k<length[i]; k++)
+		{
+			const pair<uint32_t, float>& entry = bucket[begin[i] + k];
+			e->row_cols[e->row_begin[i] + k] = entry.first;
+			e->row_values[e->row_begin[i] + k] = entry.second;
+			e->sum += entry.second;
+			e->squares += (double) entry.second*entry.second;
+		}
+	vector< pair<uint32_t, float> >().swap(bucket);
+	
+	//CSC: rows are visited in order, so that each column lists its rows sorted
+	e->col_begin.assign(e->cols + 1, 0);
+	for (uint64_t k=0; k<nnz; k++) e->col_begin[e->row_cols[k] + 1]++;
+	for (uint32_t j=0; j<e->cols; j++) e->col_begin[j + 1] += e->col_begin[j];
+	e->col_rows.resize(nnz);
+	e->col_values.resize(nnz);
+	vector<uint64_t> col_next(e->col_begin.begin(), e->col_begin.end() - 1);
+	for (long i=0; i<n_rows; i++)
+		for (uint64_t k=e->row_begin[i]; k<e->row_begin[i + 1]; k++)
+		{
+			uint64_t dest = col_next[e->row_cols[k]]++;
+			e->col_rows[dest] = i;
+			e->col_values[dest] = e->row_values[k];
+		}
+	
+	*this = Matrix();
+	sparse = e;
+	rows = e->rows;
+	cols = e->cols;
+}
+
+
+bool Matrix::isSparse() 
+{
+	return sparse.get() != NULL;
+}
+
+
+bool Matrix::convertToBinary(char* input_filename, char* output_filename) 
+{
+	ifstream is(input_filename);
+	if (!is) return false;
+	ofstream os(output_filename, ios::binary);
+	if (!os) return false;
+	
+	matrix_file_header header;
+	memcpy(header.magic, matrix_file_magic, sizeof(matrix_file_magic));
+	header.rows = 0;
+	header.cols = 0;
+	os.write((char*) &header, sizeof(header)); //it is rewritten once the matrix has been read
+	
+	running_stats stats;
+	string line;
+	while (getline(is, line))
+	{
+		floatvect row = readRow(line);
+		if (row.empty()) continue;
+		if (header.rows == 0) header.cols = row.size();
+		if (row.size() != header.cols) return false;
+		
+		for (unsigned int j=0; j<row.size(); j++)
+			stats.push(row[j]);
+		os.write((char*) &row[0], row.size()*sizeof(float));
+		header.rows++;
+	}
+	
+	header.mean = stats.mean;
+	header.variance = stats.variance();
+	os.seekp(0);
+	os.write((char*) &header, sizeof(header));
+	return header.rows > 0 && os.good();
+}
+
+
+void Matrix::clear() 
+{
+	placed_floatvect().swap(m);
+	vector<uint16_t, placed_allocator<uint16_t> >().swap(m16);
+	vector<int8_t, placed_allocator<int8_t> >().swap(m8);
+	floatvect().swap(row_scale);
+	file.reset();
+	sparse.reset();
+	viewed.reset();
+	rows = 0;
+	cols = 0;
+}
+
+
+bool Matrix::isOutOfCore() 
+{
+	return file.get() != NULL;
+}
+
+
 unsigned int Matrix::getRowsNumber() 
 {
-	return m.size();
+	return rows;
 }
 	
 
 unsigned int Matrix::getColumnsNumber() 
 {
-	return m[0].size();
+	return cols;
 }
 
 
 float Matrix::getElement(int i, int j)
 {
-	return m[i][j];
+	if (file)
+	{
+		size_t k = trasposed ? (size_t)j*rows + i : (size_t)i*cols + j;
+		float value;
+		if (pread(file->fd, &value, sizeof(value), file->offset(0) + k*sizeof(float)) != sizeof(value)) return 0.0;
+		return implicit_normalization ? (value - norm_mean)/norm_variance : value;
+	}
+	
+	if (sparse)
+	{
+		float value = trasposed ? sparse->get(j, i) : sparse->get(i, j);
+		return implicit_normalization ? (value - norm_mean)/norm_variance : value;
+	}
+	
+	if (viewed) return trasposed ? viewed->get(j, i) : viewed->get(i, j);
+	
+	size_t k = (size_t)i*cols + j;
+	switch (precision)
+	{
+		case precision_bf16: return bf16_to_float(m16[k]);
+		case precision_fp16: return fp16_to_float(m16[k]);
+		case precision_int8: return m8[k]*row_scale[i];
+		default: return m[k];
+	}
 }
 
 
 void Matrix::setElement(int i, int j, float value)
 {
-	m[i][j] = value;
+	if (file || sparse || viewed) return; //out-of-core and sparse matrices, and views, are read-only
+	
+	size_t k = (size_t)i*cols + j;
+	switch (precision)
+	{
+		case precision_bf16: m16[k] = float_to_bf16(value); break;
+		case precision_fp16: m16[k] = float_to_fp16(value); break;
+		case precision_int8: m8[k] = (int8_t) max(-127L, min(127L, lrintf(value/row_scale[i]))); break;
+		default: m[k] = value;
+	}
 }
 
 
 string Matrix::to_string()
 {
 	ostringstream output;
-	for(unsigned int i=0; i<m.size(); i++)
-		output << floatvectToString(m[i]) << endl;
+	for(unsigned int i=0; i<rows; i++)
+	{
+		for (unsigned int j=0; j<cols; j++) output << getElement(i, j) << "\t";
+		output << endl;
+	}
 	return output.str();
 }
 
 
 Matrix Matrix::copy()
 {
-	floatmatrix fm;
-	for (unsigned int i=0; i<this->m.size(); i++)
+	Matrix c = *this;
+	return c;
+}
+
+
+precision_t Matrix::getPrecision()
+{
+	return precision;
+}
+
+
+void Matrix::compress(precision_t p)
+{
+	if (precision != precision_fp32 || p == precision_fp32 || file || sparse || viewed) return;
+	
+	const int r = rows;
+	const size_t c = cols;
+	
+	if (p == precision_int8)
 	{
-		floatvect fv;
-		for (unsigned int j=0; j<this->m[0].size(); j++)
-			fv.push_back(m[i][j]);
-		fm.push_back(fv);
+		m8.resize(m.size());
+		row_scale.resize(rows);
+		#pragma omp parallel for schedule(static)
+		for (int i=0; i<r; i++)
+		{
+			const float* row = &m[i*c];
+			float max_abs = 0.0;
+			for (size_t j=0; j<c; j++)
+				max_abs = max(max_abs, fabsf(row[j]));
+			
+			float scale = (max_abs > 0.0) ? max_abs/127.0 : 1.0;
+			row_scale[i] = scale;
+			for (size_t j=0; j<c; j++)
+				m8[i*c + j] = (int8_t) lrintf(row[j]/scale);
+		}
+	}
+	else
+	{
+		m16.resize(m.size());
+		const long n = m.size();
+		#pragma omp parallel for schedule(static)
+		for (long k=0; k<n; k++)
+			m16[k] = (p == precision_bf16) ? float_to_bf16(m[k]) : float_to_fp16(m[k]);
 	}
 	
-	return Matrix(fm);
+	placed_floatvect().swap(m); //it releases the float entries
+	precision = p;
+}
+
+
+scalar_t Matrix::getAccumulation()
+{
+	return accumulation;
+}
+
+
+void Matrix::setAccumulation(scalar_t a)
+{
+	accumulation = a;
+}
+
+
+bool Matrix::parseScalar(const string& s, scalar_t& a)
+{
+	if (s == "fp32") a = scalar_fp32;
+	else if (s == "fp64") a = scalar_fp64;
+	else return false;
+	return true;
+}
+
+
+bool Matrix::parsePrecision(const string& s, precision_t& p)
+{
+	if (s == "fp32") p = precision_fp32;
+	else if (s == "bf16") p = precision_bf16;
+	else if (s == "fp16") p = precision_fp16;
+	else if (s == "int8") p = precision_int8;
+	else return false;
+	return true;
 }
 
 
@@ -108,47 +827,402 @@ Matrix Matrix::copy()
 
 
 
+Matrix Matrix::view(const intvect& row_index, const intvect& col_index, const intvect& shifts)
+{
+	Matrix v;
+	if (file || sparse || viewed || col_index.empty()) return v; //only in-memory dense matrices can be viewed
+	
+	v.viewed = make_shared<matrix_view>();
+	v.viewed->entries = (precision == precision_fp32) ? (const void*) m.data() : (precision == precision_int8) ? (const void*) m8.data() : (const void*) m16.data();
+	v.viewed->row_scale = row_scale.data();
+	v.viewed->stride = cols;
+	v.viewed->precision = precision;
+	v.viewed->rows = row_index;
+	v.viewed->cols = col_index;
+	for (unsigned int r=0; r<shifts.size(); r++)
+		v.viewed->shifts.push_back(shifts[r] % col_index.size());
+	v.rows = row_index.size();
+	v.cols = col_index.size();
+	v.precision = precision;
+	v.accumulation = accumulation;
+	return v;
+}
+
+
+floatvect Matrix::rowVariances()
+{
+	floatvect variances;
+	if (file || sparse || viewed || precision != precision_fp32) return variances;
+	
+	const int r = rows;
+	const size_t c = cols;
+	variances.resize(r);
+	#pragma omp parallel for schedule(static)
+	for(int i=0; i<r; i++)
+	{
+		running_stats stats;
+		const float* row = &m[i*c];
+		for(size_t j=0; j<c; j++)
+			stats.push(row[j]);
+		variances[i] = stats.variance();
+	}
+	return variances;
+}
+
+
+floatvect Matrix::rowMeans()
+{
+	floatvect means;
+	if (file || sparse || viewed || precision != precision_fp32) return means;
+	
+	const int r = rows;
+	const size_t c = cols;
+	means.resize(r);
+	#pragma omp parallel for schedule(static)
+	for(int i=0; i<r; i++)
+	{
+		double sum = 0.0;
+		const float* row = &m[i*c];
+		for(size_t j=0; j<c; j++)
+			sum += row[j];
+		means[i] = (c > 0) ? sum/c : 0.0;
+	}
+	return means;
+}
+
+
+bool Matrix::keepRows(const intvect& row_index)
+{
+	if (file || sparse || viewed || precision != precision_fp32) return false;
+	
+	//rows only move up, since they are kept in increasing order
+	const size_t c = cols;
+	for(size_t i=0; i<row_index.size(); i++)
+		if ((size_t) row_index[i] != i) std::copy(m.begin() + row_index[i]*c, m.begin() + (row_index[i] + 1)*c, m.begin() + i*c);
+	m.resize(row_index.size()*c);
+	m.shrink_to_fit();
+	rows = row_index.size();
+	return true;
+}
+
+
 Matrix Matrix::traspose() 
 {
-	floatmatrix n;
-	for(unsigned int j=0; j<m[0].size(); j++) {
-		floatvect v;
-		for(unsigned int i=0; i<m.size(); i++) 
-			v.push_back(m[i][j]);
-		n.push_back(v);
+	if (file || sparse || viewed)
+	{
+		Matrix t = *this;
+		t.trasposed = !trasposed;
+		t.rows = cols;
+		t.cols = rows;
+		return t;
+	}
+	
+	Matrix n(cols, rows);
+	const int tile = transpose_tile;
+	const int r = rows;
+	const int c = cols;
+	
+	//each thread owns a band of rows of the trasposed matrix (i.e., of columns of this one)
+	#pragma omp parallel for schedule(static)
+	for(int jj=0; jj<c; jj+=tile)
+	{
+		int j_end = min(jj + tile, c);
+		for(int ii=0; ii<r; ii+=tile)
+		{
+			int i_end = min(ii + tile, r);
+			for(int j=jj; j<j_end; j++)
+				for(int i=ii; i<i_end; i++) 
+					n.m[(size_t)j*r + i] = m[(size_t)i*c + j];
+		}
 	}	
 	
-	return Matrix(n);
+	return n;
 }
 
 
 
 void Matrix::normalize()
 {
-	floatvect tmp;
-	for(unsigned int i=0; i<m.size(); i++) 
-		for(unsigned int j=0; j<m[i].size(); j++)
-			tmp.push_back(m[i][j]);
+	if (viewed) return; //entries are read from an already normalized matrix
 	
-	float avg = vect_mean(tmp);
-	float var = vect_variance(tmp);
+	if (file)
+	{
+		implicit_normalization = true;
+		norm_mean = file->header.mean;
+		norm_variance = file->header.variance;
+		return;
+	}
+	
+	if (sparse)
+	{
+		//zeros are entries as well
+		double n = (double) rows*cols;
+		implicit_normalization = true;
+		norm_mean = sparse->sum/n;
+		norm_variance = (sparse->squares - sparse->sum*sparse->sum/n)/(n - 1.0);
+		return;
+	}
+	
+	const int r = rows;
+	const size_t c = cols;
+	if (r == 0) return;
+	
+	//one pass on each row...
+	vector<running_stats> partial(r);
+	#pragma omp parallel for schedule(static)
+	for(int i=0; i<r; i++)
+	{
+		const float* row = &m[i*c];
+		for(size_t j=0; j<c; j++)
+			partial[i].push(row[j]);
+	}
+	
+	//...then rows are merged always in the same order
+	running_stats stats;
+	for(int i=0; i<r; i++)
+		stats.merge(partial[i]);
+	
+	float avg = stats.mean;
+	float var = stats.variance();
+	
+	const long n = m.size();
+	#pragma omp parallel for schedule(static)
+	for (long k=0; k<n; k++) 
+		m[k] = (m[k] - avg)/var;
+}
+
+float Matrix::row_dot(size_t i, const float* v)
+{
+	size_t offset = i*cols;
+	bool wide = (accumulation == scalar_fp64);
+	switch (precision)
+	{
+		case precision_bf16: return wide ? dot<bf16_storage, double>(&m16[offset], v, cols) : dot<bf16_storage, float>(&m16[offset], v, cols);
+		case precision_fp16: return wide ? dot<fp16_storage, double>(&m16[offset], v, cols) : dot<fp16_storage, float>(&m16[offset], v, cols);
+		case precision_int8: return (wide ? (float) dot<int8_storage, double>(&m8[offset], v, cols) : dot<int8_storage, float>(&m8[offset], v, cols))*row_scale[i];
+		default: return wide ? dot<fp32_storage, double>(&m[offset], v, cols) : dot<fp32_storage, float>(&m[offset], v, cols);
+	}
+}
+
+
+//set out to n zero products of the given size, reusing its vectors
+static void reset_products(floatmatrix& out, size_t n, size_t rows)
+{
+	out.resize(n);
+	for (size_t b=0; b<n; b++)
+		out[b].assign(rows, 0.0);
+}
+
+
+floatvect Matrix::vector_product(const floatvect& fv)
+{
+	floatmatrix in(1, fv);
+	floatmatrix out;
+	batch_product(in, out);
+	return out[0];
+}
+
+
+bool Matrix::batch_product(const floatmatrix& in, floatmatrix& out)
+{
+	if (file) return file_product(in, out);
+	
+	if (sparse)
+	{
+		sparse_product(in, out);
+		return true;
+	}
+	
+	reset_products(out, in.size(), rows);
+	
+	if (viewed)
+	{
+		view_kernels[trasposed][viewed->precision][accumulation](*viewed, in, out);
+		return true;
+	}
+	
+	//the kernel specialised for the storage format and the accumulator is chosen once for the whole product
+	const void* entries = (precision == precision_fp32) ? (const void*) m.data() : (precision == precision_int8) ? (const void*) m8.data() : (const void*) m16.data();
+	dense_kernels[precision][accumulation](entries, row_scale.data(), rows, cols, in, out);
+	return true;
+}
+
+
+bool Matrix::generic_product(const floatmatrix& in, floatmatrix& out)
+{
+	if (file || sparse || viewed) return batch_product(in, out);
+	
+	const int r = rows;
+	const int nv = in.size();
+	reset_products(out, nv, rows);
+	
+	#pragma omp parallel for schedule(static)
+	for (int i=0; i<r; i++)
+		for (int b=0; b<nv; b++)
+			out[b][i] = row_dot(i, &in[b][0]);
+	return true;
+}
+
+
+void Matrix::gather(const intvect& row_index, const intvect& col_index, floatvect& out)
+{
+	const size_t nr = row_index.size();
+	const size_t nc = col_index.size();
+	out.resize(nr*nc);
+	if (nr == 0 || nc == 0) return;
+	
+	if (file)
+	{
+		//a stored row is read for each row of the submatrix, or for each column if the matrix is trasposed
+		const size_t stored_cols = file->header.cols;
+		floatvect row(stored_cols);
+		const intvect& outer = trasposed ? col_index : row_index;
+		const intvect& inner = trasposed ? row_index : col_index;
+		for (size_t a=0; a<outer.size(); a++)
+		{
+			if (pread(file->fd, &row[0], stored_cols*sizeof(float), file->offset(outer[a])) != (ssize_t) (stored_cols*sizeof(float)))
+				fill(row.begin(), row.end(), 0.0);
+			for (size_t b=0; b<inner.size(); b++)
+			{
+				float value = row[inner[b]];
+				if (implicit_normalization) value = (value - norm_mean)/norm_variance;
+				if (trasposed) out[b*nc + a] = value;
+				else out[a*nc + b] = value;
+			}
+		}
+		return;
+	}
+	
+	if (viewed)
+	{
+		for (size_t r=0; r<nr; r++)
+			for (size_t k=0; k<nc; k++)
+				out[r*nc + k] = trasposed ? viewed->get(col_index[k], row_index[r]) : viewed->get(row_index[r], col_index[k]);
+		return;
+	}
+	
+	if (sparse)
+	{
+		//zeros are entries as well, and the nonzero ones are merged with the sorted columns
+		const placed_offsetvect& begin = trasposed ? sparse->col_begin : sparse->row_begin;
+		const placed_indexvect& index = trasposed ? sparse->col_rows : sparse->row_cols;
+		const placed_floatvect& values = trasposed ? sparse->col_values : sparse->row_values;
+		const float zero = implicit_normalization ? (0.0 - norm_mean)/norm_variance : 0.0;
+		fill(out.begin(), out.end(), zero);
+		for (size_t r=0; r<nr; r++)
+		{
+			uint64_t k = begin[row_index[r]], last = begin[row_index[r] + 1];
+			size_t j = 0;
+			while (k < last && j < nc)
+			{
+				if (index[k] < (uint32_t) col_index[j]) k++;
+				else if ((uint32_t) col_index[j] < index[k]) j++;
+				else
+				{
+					out[r*nc + j] = implicit_normalization ? (values[k] - norm_mean)/norm_variance : values[k];
+					k++;
+					j++;
+				}
+			}
+		}
+		return;
+	}
+	
+	const void* entries = (precision == precision_fp32) ? (const void*) m.data() : (precision == precision_int8) ? (const void*) m8.data() : (const void*) m16.data();
+	dense_gathers[precision](entries, row_scale.data(), cols, row_index, col_index, &out[0]);
+}
+
+
+bool Matrix::file_product(const floatmatrix& in, floatmatrix& out)
+{
+	const size_t stored_rows = file->header.rows;
+	const size_t stored_cols = file->header.cols;
+	const size_t block = max((size_t)1, out_of_core_block/(stored_cols*sizeof(float)));
+	const size_t column_chunk = 1024;
+	const int nv = in.size();
+	
+	reset_products(out, nv, rows);
+	
+	for (size_t first=0; first<stored_rows; first+=block)
+	{
+		size_t last = min(first + block, stored_rows);
+		
+		//in the trasposed product, stored rows having weight zero for all the vectors do not contribute
+		if (trasposed)
+		{
+			bool contributes = false;
+			for (int b=0; b<nv && !contributes; b++)
+				for (size_t i=first; i<last && !contributes; i++)
+					contributes = (in[b][i] != 0.0);
+			if (!contributes) continue;
+		}
 		
-	for (unsigned int i=0; i<m.size(); i++) 
-		for(unsigned int j=0; j<m[i].size(); j++)	
-			m[i][j] = (m[i][j] - avg)/var;
+		if (last < stored_rows) file->read_ahead(last, min(last + block, stored_rows));
+		
+		void* base;
+		size_t length;
+		const float* data = file->map(first, last, base, length);
+		if (data == NULL) return false;
+		
+		if (!trasposed)
+		{
+			file_kernels[accumulation](data, first, last, stored_cols, in, out);
+		}
+		else
+		{
+			//columns are split among threads, so that each entry is always accumulated in the same order
+			const long chunks = (stored_cols + column_chunk - 1)/column_chunk;
+			#pragma omp parallel for schedule(static)
+			for (long c=0; c<chunks; c++)
+			{
+				size_t j_begin = c*column_chunk;
+				size_t j_end = min(j_begin + column_chunk, stored_cols);
+				for (size_t i=first; i<last; i++)
+				{
+					const float* row = data + (i - first)*stored_cols;
+					for (int b=0; b<nv; b++)
+					{
+						float w = in[b][i];
+						if (w == 0.0) continue;
+						float* y = &out[b][0];
+						#pragma omp simd
+						for (size_t j=j_begin; j<j_end; j++)
+							y[j] += w*row[j];
+					}
+				}
+			}
+		}
+		
+		munmap(base, length);
+	}
+	
+	shift_products(in, out);
+	return true;
 }
 
-floatvect Matrix::vector_product(floatvect fv)
+
+void Matrix::sparse_product(const floatmatrix& in, floatmatrix& out)
 {
-	floatmatrix fm = this->m;
-	floatvect rv;
-	for (unsigned int i=0; i<fm.size(); i++) 
-		rv.push_back(0.0);
+	const placed_offsetvect& begin = trasposed ? sparse->col_begin : sparse->row_begin;
+	const placed_indexvect& index = trasposed ? sparse->col_rows : sparse->row_cols;
+	const placed_floatvect& values = trasposed ? sparse->col_values : sparse->row_values;
 	
-	for (unsigned int i=0; i<fm.size(); i++)
-       for (unsigned int j=0; j<fm[i].size(); j++)
-			rv[i] += fm[i][j]*fv[j];
-			
-    return rv;       
+	reset_products(out, in.size(), rows);
+	sparse_kernels[accumulation](begin.data(), index.data(), values.data(), rows, in, out);
+	
+	shift_products(in, out);
 }
 
+
+void Matrix::shift_products(const floatmatrix& in, floatmatrix& out)
+{
+	if (!implicit_normalization) return;
+	
+	//(x - mean)/variance, summed over the vector entries
+	for (unsigned int b=0; b<in.size(); b++)
+	{
+		float shift = norm_mean*accumulate(in[b].begin(), in[b].end(), 0.0);
+		for (unsigned int i=0; i<rows; i++)
+			out[b][i] = (out[b][i] - shift)/norm_variance;
+	}
+}
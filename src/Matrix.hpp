@@ -33,17 +33,72 @@
 #include <vector>
 #include <limits>
 #include <float.h>
+#include <stdint.h>
+#include <memory>
 
 #include "utilities.h"
+#include "Memory.hpp"
 
 using namespace std;
 
 
 
+/**
+	\brief Storage formats for the matrix entries.
+	
+	Reduced precision formats are meant for normalized matrices: entries are decoded on the fly 
+	by the product kernels and accumulated in float (\see scalar_t). int8 entries are scaled row by row.
+*/
+
+enum precision_t { precision_fp32, precision_bf16, precision_fp16, precision_int8 };
+
+
+/**
+	\brief Accumulator of the product kernels.
+	
+	Each (storage format, accumulator) pair has its own kernel, specialised at compile time.
+*/
+
+enum scalar_t { scalar_fp32, scalar_fp64 };
+
+
+/**
+	\brief Out-of-core storage: a binary expression file, mapped a block of rows at a time.
+	
+	\see Matrix::mapFromFile
+*/
+
+struct matrix_file;
+
+
+/**
+	\brief Sparse storage: nonzero entries both by row (CSR) and by column (CSC).
+	
+	\see Matrix::loadSparseFromFile
+*/
+
+struct sparse_entries;
+
+
+/**
+	\brief Index view: selected rows and columns of another matrix, each row possibly rotated.
+	
+	\see Matrix::view
+*/
+
+struct matrix_view;
+
+
 /**
 	\brief Matrix class. 
 	
 	It represent a gene expression matrix as a float matrix, where each row represent a gene, each column represent a condition and cells represent expression level values.
+	
+	Entries can be compressed to a reduced precision format (\see compress), in which case the float entries are released.
+	Entries can also be left on disk (\see mapFromFile): products then stream the binary file, and normalization and 
+	transposition are applied on the fly. Sparse matrices (\see loadSparseFromFile) are normalized and trasposed on the 
+	fly as well, so that zeros are never stored. A matrix can also be a view of the rows and columns of another one 
+	(\see view), whose entries it reads in place.
 	 
  */
 
@@ -51,10 +106,41 @@ class Matrix {
 
 private:
 
-	floatmatrix m;
-	floatvect readRow(string row); 
-	floatmatrix readVector(istream &is); 
+	placed_floatvect m; //row-major entries
+	unsigned int rows;
+	unsigned int cols;
+	
+	precision_t precision;
+	scalar_t accumulation;
+	vector<uint16_t, placed_allocator<uint16_t> > m16; //bf16 or fp16 row-major entries
+	vector<int8_t, placed_allocator<int8_t> > m8; //int8 row-major entries...
+	floatvect row_scale; //...and their scale, one for each row
 	
+	shared_ptr<matrix_file> file; //out-of-core entries
+	bool trasposed; //set if the out-of-core matrix is the traspose of the stored one
+	bool implicit_normalization; //set if entries are normalized on the fly...
+	float norm_mean; //...by subtracting the mean...
+	float norm_variance; //...and dividing by the variance
+	shared_ptr<sparse_entries> sparse; //sparse entries
+	shared_ptr<matrix_view> viewed; //entries of another matrix, if this is a view
+	
+	float row_dot(size_t i, const float* v);
+	bool file_product(const floatmatrix& in, floatmatrix& out);
+	void sparse_product(const floatmatrix& in, floatmatrix& out);
+	void shift_products(const floatmatrix& in, floatmatrix& out);
+	
+	static floatvect readRow(string row); 
+	void readVector(istream &is); 
+
+/**
+	\brief  Return a matrix with r rows and c columns, whose entries are set to zero.
+	
+	\param r number of rows
+	\param c number of columns
+	\return the matrix
+*/
+
+	Matrix(unsigned int r, unsigned int c) : m((size_t)r*c, 0.0), rows(r), cols(c), precision(precision_fp32), accumulation(scalar_fp32), trasposed(false), implicit_normalization(false), norm_mean(0.0), norm_variance(1.0) {};
 	
 
 public:
@@ -65,7 +151,7 @@ public:
 	\return the matrix
 */
 
-	Matrix() {};
+	Matrix() : rows(0), cols(0), precision(precision_fp32), accumulation(scalar_fp32), trasposed(false), implicit_normalization(false), norm_mean(0.0), norm_variance(1.0) {};
 
 /**
 	\brief  Return an initialized matrix.
@@ -74,9 +160,11 @@ public:
 	\return the matrix
 */
 	
-	Matrix(floatmatrix& fm)
+	Matrix(floatmatrix& fm) : rows(fm.size()), cols(fm.empty() ? 0 : fm[0].size()), precision(precision_fp32), accumulation(scalar_fp32), trasposed(false), implicit_normalization(false), norm_mean(0.0), norm_variance(1.0)
 	{
-		m = fm;
+		m.reserve((size_t)rows*cols);
+		for (unsigned int i=0; i<rows; i++)
+			m.insert(m.end(), fm[i].begin(), fm[i].end());
 	};
 
 /**
@@ -93,6 +181,116 @@ public:
 */	
 	
 	void loadFromFile(char* filename);
+
+/**
+	\brief Return an out-of-core matrix stored in the binary file filename.
+	
+	Entries are not loaded: each product maps the file a block of out_of_core_block bytes at a time, 
+	and asks the kernel to read ahead the following block. If the file cannot be used the matrix is empty.
+	
+	\see convertToBinary
+	\param filename filepath
+*/	
+
+	void mapFromFile(char* filename);
+
+/**
+	\brief Return a sparse matrix saved in filename, in Matrix Market coordinate format or as a triplet file.
+	
+	Triplet files list a nonzero entry per line, as 0-based row index, column index and value; the matrix size is 
+	given by the largest indices. Repeated entries are summed. Entries are stored both by row and by column, so that 
+	products in both directions gather their operands, and the result does not depend on the number of threads.
+	If the file cannot be read the matrix is empty.
+	
+	\param filename filepath
+*/	
+
+	void loadSparseFromFile(char* filename);
+
+/**
+	\brief Return whether only the nonzero entries are stored
+	
+	\return true if the matrix is sparse, false otherwise
+*/	
+
+	bool isSparse();
+
+/**
+	\brief Save the matrix in the text file input_filename as a binary file, for out-of-core usage.
+	
+	The text file is read one row at a time, so that the matrix does not need to fit in memory. 
+	Mean and variance of the entries are stored as well, so that normalization requires no further pass.
+	
+	\param input_filename text filepath
+	\param output_filename binary filepath
+	\return true on success, false otherwise
+*/	
+
+	static bool convertToBinary(char* input_filename, char* output_filename);
+
+/**
+	\brief Return whether entries are stored on disk
+	
+	\return true if the matrix is out-of-core, false otherwise
+*/	
+
+	bool isOutOfCore();
+	
+/**
+	\brief Return a view of rows and columns of this matrix, which reads its entries in place.
+	
+	Entry (r, k) of the view is entry (row_index[r], col_index[(k + shifts[r]) % c]) of this matrix, c being the number 
+	of columns of the view: columns can be repeated (e.g., to resample them) and each row can be rotated by its own shift 
+	(e.g., to break the correlation between rows while keeping their values). The products of the view are evaluated 
+	by kernels specialised for the storage format, which gather the columns of each row; the transposed product 
+	accumulates fixed chunks of rows, merged in order, so that the result does not depend on the number of threads.
+	The view is read-only, needs no normalization, can be trasposed, and is valid as long as this matrix is not changed. 
+	Only in-memory dense matrices can be viewed: otherwise the view is empty.
+	
+	\param row_index the rows
+	\param col_index the columns
+	\param shifts the rotation of each row, empty if rows are not rotated
+	\return the view
+*/	
+
+	Matrix view(const intvect& row_index, const intvect& col_index, const intvect& shifts);
+
+/**
+	\brief Return the variance of the entries of each row.
+	
+	Only in-memory dense float matrices are summarised: otherwise the result is empty.
+	
+	\return the variance of each row
+*/	
+
+	floatvect rowVariances();
+
+/**
+	\brief Return the mean of the entries of each row.
+	
+	Only in-memory dense float matrices are summarised: otherwise the result is empty.
+	
+	\return the mean of each row
+*/	
+
+	floatvect rowMeans();
+
+/**
+	\brief Keep some rows of the matrix, in place, releasing the memory of the others.
+	
+	Only in-memory dense float matrices can be compacted.
+	
+	\param row_index the rows kept, in increasing order
+	\return false if the matrix cannot be compacted, true otherwise
+*/	
+
+	bool keepRows(const intvect& row_index);
+
+/**
+	\brief Release all the entries, leaving an empty matrix.
+*/	
+	
+	void clear();
 	
 /**
 	\brief Return a string representing the matrix
@@ -151,11 +349,107 @@ public:
 /**
 	\brief Return the matrix-vector product
 	
+	Reduced precision entries are decoded on the fly, products are accumulated in float or in double (\see setAccumulation).
+	
 	\param fv the vector
 	\return the product 
 */		
 	
-	floatvect vector_product(floatvect fv);	
+	floatvect vector_product(const floatvect& fv);	
+
+/**
+	\brief Return the products between the matrix and a batch of vectors, evaluated in a single pass over the matrix.
+	
+	The kernel is picked from a table of instantiations, one for each storage backend and accumulator, so that its 
+	inner loop has no branch on them. The transposed product of an out-of-core matrix always accumulates in float.
+	
+	\param in the vectors
+	\param out the products, one for each vector (its vectors are reused when they have room enough)
+	\return false if the stored rows of an out-of-core matrix cannot be mapped (the products are then incomplete)
+*/		
+	
+	bool batch_product(const floatmatrix& in, floatmatrix& out);	
+
+/**
+	\brief Return the same products of batch_product, choosing the kernel row by row.
+	
+	It is the baseline of the specialised kernels (\see the benchmark subcommand).
+	
+	\param in the vectors
+	\param out the products, one for each vector
+	\return false if the stored rows of an out-of-core matrix cannot be mapped
+*/		
+	
+	bool generic_product(const floatmatrix& in, floatmatrix& out);	
+
+/**
+	\brief Return the submatrix of the given rows and columns
+	
+	Only the entries of the submatrix are read, by a kernel specialised for the storage format; entries are decoded 
+	and normalized as by getElement. Out-of-core matrices read a stored row for each row of the submatrix (or for each 
+	column, if trasposed), and sparse matrices merge the nonzero entries of each row with the columns.
+	
+	\param row_index the rows
+	\param col_index the columns, in increasing order
+	\param out the row-major entries of the submatrix
+*/		
+	
+	void gather(const intvect& row_index, const intvect& col_index, floatvect& out);	
+
+/**
+	\brief Return the accumulator of the products
+	
+	\return the accumulator
+*/	
+
+	scalar_t getAccumulation();
+
+/**
+	\brief Set the accumulator of the products
+	
+	\param a the accumulator
+*/	
+
+	void setAccumulation(scalar_t a);
+
+/**
+	\brief Return the accumulator named s (fp32 or fp64)
+	
+	\param s the accumulator name
+	\param a the accumulator, set only if s is a valid name
+	\return true if s is a valid name, false otherwise
+*/	
+
+	static bool parseScalar(const string& s, scalar_t& a);
+
+/**
+	\brief Return the storage format of the matrix entries
+	
+	\return the storage format
+*/	
+
+	precision_t getPrecision();
+
+/**
+	\brief Store the matrix entries in the format p and release the float entries.
+	
+	Only a dense in-memory float matrix can be compressed. Since values are rounded, it should be called only once the matrix 
+	has been normalized: traspose and normalize must not be called afterwards.
+	
+	\param p the storage format
+*/	
+
+	void compress(precision_t p);
+
+/**
+	\brief Return the storage format named s (fp32, bf16, fp16 or int8)
+	
+	\param s the format name
+	\param p the storage format, set only if s is a valid name
+	\return true if s is a valid name, false otherwise
+*/	
+
+	static bool parsePrecision(const string& s, precision_t& p);
 
 //====================================================================
 //            			ISA biclustering							//
@@ -164,6 +458,10 @@ public:
 /**
 	\brief Return the matrix traspose
 	
+	The matrix is visited in square tiles of transpose_tile entries per side, so that both the source 
+	and the destination tile stay in cache. Tiles are distributed among threads by destination row.
+	The traspose of an out-of-core or sparse matrix shares its entries, and no entry is moved.
+	
 	\return the trasposed matrix
 */	
 	
@@ -172,6 +470,11 @@ public:
 /**
 	\brief Return the normalized matrix, i.e. a matrix having  0 mean and 1 standard deviation. 
 	
+	Mean and variance are evaluated in a single pass (Welford): each row is summarised in parallel and 
+	the partial summaries are merged in row order, so that the result does not depend on the number of threads.
+	Out-of-core matrices use the mean and variance stored in their file, and are normalized on the fly.
+	Sparse matrices are normalized on the fly as well, by the mean and variance of all their entries (zeros included).
+	
 	\return the normalized matrix
 */	
 	
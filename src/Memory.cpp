@@ -0,0 +1,372 @@
+//      Memory.cpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#include "Memory.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <omp.h>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+
+
+static const size_t page_bytes = 4096;
+static const size_t huge_page_bytes = 2 << 20;
+static const unsigned int max_nodes = 64; //size of the node masks
+
+static numa_policy_t numa = numa_default;
+static huge_pages_t huge_pages = huge_pages_none;
+static bool prefault = false;
+
+//placed buffers, and their length once rounded to pages
+static map<void*, size_t> regions;
+
+//updated in the memory_regions critical section, since buffers may be placed by several threads
+static struct counters_t
+{
+	size_t placed;
+	size_t peak;
+	size_t explicit_huge;
+	size_t transparent_huge;
+	unsigned int huge_fallbacks;
+	size_t prefaulted;
+	double prefault_seconds;
+	unsigned int pinned_threads;
+} counters;
+
+
+#ifdef ALLOCATION_STATS
+#include <atomic>
+
+static atomic<unsigned long> allocation_count(0);
+
+void* operator new(size_t n)
+{
+	allocation_count++;
+	void* p = malloc(n == 0 ? 1 : n);
+	if (p == NULL) throw bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t n)
+{
+	return operator new(n);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+#endif
+
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+static size_t round_up(size_t n, size_t unit)
+{
+	return ((n + unit - 1)/unit)*unit;
+}
+
+//cpus of each node, read from sysfs (e.g. "0-3,8-11")
+static vector< vector<int> > read_node_cpus()
+{
+	vector< vector<int> > cpus;
+	for (unsigned int node=0; node<max_nodes; node++)
+	{
+		ostringstream path;
+		path << "/sys/devices/system/node/node" << node << "/cpulist";
+		ifstream is(path.str().c_str());
+		if (!is) break;
+
+		vector<int> list;
+		string range;
+		while (getline(is, range, ','))
+		{
+			int first, last;
+			char dash;
+			istringstream rs(range);
+			if (!(rs >> first)) continue;
+			if (!(rs >> dash >> last)) last = first;
+			for (int cpu=first; cpu<=last; cpu++) list.push_back(cpu);
+		}
+		cpus.push_back(list);
+	}
+	return cpus;
+}
+
+//they are read once, by the first thread that needs them
+static const vector< vector<int> >& node_cpus()
+{
+	static const vector< vector<int> > cpus = read_node_cpus();
+	return cpus;
+}
+
+static long mbind(void* p, size_t length, int mode, unsigned long mask)
+{
+	return syscall(SYS_mbind, p, length, mode, &mask, max_nodes + 1, 0);
+}
+
+//it binds the pages of a buffer according to the NUMA policy
+static void bind(char* p, size_t length, size_t unit)
+{
+	unsigned int n = Memory::nodes();
+	if (n < 2) return;
+
+	if (numa == numa_interleave)
+		mbind(p, length, MPOL_INTERLEAVE, (n >= 64) ? ~0UL : (1UL << n) - 1);
+	else if (numa == numa_partition)
+	{
+		size_t chunk = round_up(length/n, unit);
+		for (unsigned int k=0; k<n && k*chunk<length; k++)
+			mbind(p + k*chunk, min(chunk, length - k*chunk), MPOL_PREFERRED, 1UL << k);
+	}
+}
+
+
+void Memory::configure(numa_policy_t n, huge_pages_t h, bool p)
+{
+	numa = n;
+	huge_pages = h;
+	prefault = p;
+}
+
+
+void* Memory::allocate(size_t n)
+{
+	if (n < placement_min_bytes || (numa == numa_default && huge_pages == huge_pages_none && !prefault))
+		return ::operator new(n);
+
+	size_t length = 0;
+	void* p = MAP_FAILED;
+	bool huge = false;
+	bool fallback = false;
+	bool advised = false;
+
+	if (huge_pages == huge_pages_explicit)
+	{
+		length = round_up(n, huge_page_bytes);
+		p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		huge = (p != MAP_FAILED);
+		fallback = !huge; //no pages reserved: transparent ones are used instead
+	}
+	if (p == MAP_FAILED)
+	{
+		length = round_up(n, page_bytes);
+		p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) throw bad_alloc();
+		advised = (huge_pages != huge_pages_none && madvise(p, length, MADV_HUGEPAGE) == 0);
+	}
+
+	bind((char*) p, length, huge ? huge_page_bytes : page_bytes);
+
+	//pages are touched by the (pinned) threads that will read them, in the same order of the kernels
+	double prefault_seconds = 0.0;
+	if (prefault)
+	{
+		double start = now();
+		char* c = (char*) p;
+		const long pages = length/page_bytes;
+		#pragma omp parallel for schedule(static)
+		for (long k=0; k<pages; k++)
+			c[k*page_bytes] = 0;
+		prefault_seconds = now() - start;
+	}
+
+	#pragma omp critical(memory_regions)
+	{
+		regions[p] = length;
+		counters.placed += length;
+		counters.peak = max(counters.peak, counters.placed);
+		if (fallback) counters.huge_fallbacks++;
+		if (huge) counters.explicit_huge += length;
+		if (advised) counters.transparent_huge += length;
+		if (prefault)
+		{
+			counters.prefaulted += length;
+			counters.prefault_seconds += prefault_seconds;
+		}
+	}
+	return p;
+}
+
+
+void Memory::deallocate(void* p, size_t n)
+{
+	size_t length = 0;
+	#pragma omp critical(memory_regions)
+	{
+		map<void*, size_t>::iterator it = regions.find(p);
+		if (it != regions.end())
+		{
+			length = it->second;
+			counters.placed -= length;
+			regions.erase(it);
+		}
+	}
+
+	if (length > 0) munmap(p, length);
+	else ::operator delete(p);
+}
+
+
+void Memory::pinThreads()
+{
+	const vector< vector<int> >& cpus = node_cpus();
+	if (cpus.empty()) return;
+
+	#pragma omp parallel
+	{
+		int node = omp_get_thread_num()*cpus.size()/omp_get_num_threads();
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (unsigned int k=0; k<cpus[node].size(); k++)
+			CPU_SET(cpus[node][k], &set);
+
+		if (sched_setaffinity(0, sizeof(set), &set) == 0)
+		{
+			#pragma omp critical(memory_regions)
+			counters.pinned_threads++;
+		}
+	}
+}
+
+
+unsigned int Memory::nodes()
+{
+	return max((size_t)1, node_cpus().size());
+}
+
+
+string Memory::to_string()
+{
+	const char* numa_names[] = {"none", "interleave", "partition"};
+	const char* huge_names[] = {"none", "transparent", "explicit"};
+	const size_t mb = 1 << 20;
+	const unsigned int samples = 1024; //pages queried for each buffer
+
+	//where placed pages actually are
+	vector<double> node_bytes(nodes(), 0.0);
+	double unknown_bytes = 0.0;
+	counters_t placement;
+	size_t buffers;
+	#pragma omp critical(memory_regions)
+	{
+		placement = counters;
+		buffers = regions.size();
+		for (map<void*, size_t>::iterator it = regions.begin(); it != regions.end(); it++)
+		{
+			unsigned long pages = it->second/page_bytes;
+			unsigned long count = min((unsigned long)samples, pages);
+			vector<void*> addresses(count);
+			vector<int> status(count, -1);
+			for (unsigned long k=0; k<count; k++)
+				addresses[k] = (char*) it->first + (k*pages/count)*page_bytes;
+
+			bool queried = syscall(SYS_move_pages, 0, count, &addresses[0], NULL, &status[0], 0) == 0;
+			for (unsigned long k=0; k<count; k++)
+			{
+				double share = (double) it->second/count;
+				if (queried && status[k] >= 0 && status[k] < (int) node_bytes.size()) node_bytes[status[k]] += share;
+				else unknown_bytes += share;
+			}
+		}
+	}
+
+	size_t anon_huge_kb = 0;
+	ifstream smaps("/proc/self/smaps_rollup");
+	string line;
+	while (getline(smaps, line))
+		if (line.find("AnonHugePages:") == 0) istringstream(line.substr(14)) >> anon_huge_kb;
+
+	ostringstream output;
+	output << "NUMA policy: " << numa_names[numa] << ", huge pages: " << huge_names[huge_pages] << ", nodes: " << nodes() << endl;
+	output << "\tplaced: " << placement.placed/mb << " MB in " << buffers << " buffers (peak " << placement.peak/mb << " MB)" << endl;
+	output << "\thuge pages: " << placement.explicit_huge/mb << " MB explicit, " << placement.transparent_huge/mb << " MB advised, "
+	       << anon_huge_kb/1024 << " MB backed (" << placement.huge_fallbacks << " fallbacks)" << endl;
+	output << "\tprefaulted: " << placement.prefaulted/mb << " MB in " << placement.prefault_seconds << " s" << endl;
+	output << "\tpinned threads: " << placement.pinned_threads << endl;
+	for (unsigned int k=0; k<node_bytes.size(); k++)
+		output << "\tnode " << k << ": " << (size_t) (node_bytes[k]/mb) << " MB" << endl;
+	if (unknown_bytes > 0) output << "\tnot resident: " << (size_t) (unknown_bytes/mb) << " MB" << endl;
+	return output.str();
+}
+
+
+bool Memory::parseNumaPolicy(const string& s, numa_policy_t& p)
+{
+	if (s == "none") p = numa_default;
+	else if (s == "interleave") p = numa_interleave;
+	else if (s == "partition") p = numa_partition;
+	else return false;
+	return true;
+}
+
+
+bool Memory::parseHugePages(const string& s, huge_pages_t& h)
+{
+	if (s == "none") h = huge_pages_none;
+	else if (s == "transparent") h = huge_pages_transparent;
+	else if (s == "explicit") h = huge_pages_explicit;
+	else return false;
+	return true;
+}
+
+
+bool Memory::allocations(unsigned long& count)
+{
+#ifdef ALLOCATION_STATS
+	count = allocation_count;
+	return true;
+#else
+	count = 0;
+	return false;
+#endif
+}
@@ -0,0 +1,189 @@
+//      Memory.hpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <new>
+
+using namespace std;
+
+
+
+/**
+	\brief Placement of the buffers across NUMA nodes.
+
+	numa_interleave spreads pages round-robin on all the nodes; numa_partition splits each buffer
+	in as many contiguous chunks as nodes, so that the rows of a matrix are partitioned among nodes.
+*/
+
+enum numa_policy_t { numa_default, numa_interleave, numa_partition };
+
+/**
+	\brief Page size of the buffers: explicit huge pages require pages reserved in the hugetlb pool.
+*/
+
+enum huge_pages_t { huge_pages_none, huge_pages_transparent, huge_pages_explicit };
+
+static const size_t placement_min_bytes = 2 << 20; //smaller buffers are not placed
+
+
+
+/**
+	\brief Memory class.
+
+	Allocation layer for the large buffers (expression and driver entries). Buffers of at least
+	placement_min_bytes are mapped directly, bound to NUMA nodes according to the policy, backed
+	with huge pages and, if required, prefaulted. Smaller buffers, and all buffers when no placement
+	is configured, are allocated as usual.
+
+	The layer keeps counters about the placed buffers, \see to_string.
+
+ */
+
+class Memory {
+
+public:
+
+/**
+	\brief Set the placement of the buffers allocated from now on.
+
+	\param numa NUMA policy
+	\param huge_pages page size
+	\param prefault set if pages are touched at allocation time
+*/
+
+	static void configure(numa_policy_t numa, huge_pages_t huge_pages, bool prefault);
+
+/**
+	\brief Return a buffer of n bytes
+
+	\param n number of bytes
+	\return the buffer
+*/
+
+	static void* allocate(size_t n);
+
+/**
+	\brief Release a buffer of n bytes returned by allocate
+
+	\param p the buffer
+	\param n number of bytes
+*/
+
+	static void deallocate(void* p, size_t n);
+
+/**
+	\brief Pin the threads of the OpenMP team to NUMA nodes.
+
+	Thread t out of T is pinned to the cpus of node t*N/T. Since the rows of a partitioned buffer
+	and the iterations of a static loop over them are split in the same order, each thread reads
+	node-local rows.
+*/
+
+	static void pinThreads();
+
+/**
+	\brief Return the number of NUMA nodes
+
+	\return number of nodes
+*/
+
+	static unsigned int nodes();
+
+/**
+	\brief Return a string reporting the placement counters.
+
+	The node of each placed page is queried from the kernel (on a sample of pages), so the report
+	shows where buffers actually are.
+
+	\return the string representing the counters
+*/
+
+	static string to_string();
+
+/**
+	\brief Return the NUMA policy named s (none, interleave or partition)
+
+	\param s the policy name
+	\param p the policy, set only if s is a valid name
+	\return true if s is a valid name, false otherwise
+*/
+
+	static bool parseNumaPolicy(const string& s, numa_policy_t& p);
+
+/**
+	\brief Return the page size named s (none, transparent or explicit)
+
+	\param s the page size name
+	\param h the page size, set only if s is a valid name
+	\return true if s is a valid name, false otherwise
+*/
+
+	static bool parseHugePages(const string& s, huge_pages_t& h);
+
+/**
+	\brief Return the number of heap allocations (through operator new) made so far.
+
+	Allocations are counted only if built with ALLOCATION_STATS defined (make ALLOCATION_STATS=1), which replaces 
+	the global operator new.
+
+	\param count the number of allocations
+	\return true if allocations are counted, false otherwise
+*/
+
+	static bool allocations(unsigned long& count);
+
+} ;
+
+
+
+/**
+	\brief Standard allocator placing its buffers with the Memory layer.
+*/
+
+template <class T>
+struct placed_allocator
+{
+	typedef T value_type;
+
+	placed_allocator() {}
+	template <class U> placed_allocator(const placed_allocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(Memory::allocate(n*sizeof(T)));
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		Memory::deallocate(p, n*sizeof(T));
+	}
+
+	template <class U> bool operator==(const placed_allocator<U>&) const { return true; }
+	template <class U> bool operator!=(const placed_allocator<U>&) const { return false; }
+};
+
+typedef vector<float, placed_allocator<float> > placed_floatvect;
+
+#endif
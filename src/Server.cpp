@@ -0,0 +1,530 @@
+//      Server.cpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#include "Server.hpp"
+#include "Trace.hpp"
+
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <omp.h>
+
+
+struct Server::Job
+{
+	int priority;
+	unsigned long order; //submission order
+	JobConfig config;
+	shared_ptr<Engine> engine;
+	int fd; //client connection
+	bool finished;
+	job_status_t status;
+	unsigned long found;
+	JobStats stats;
+};
+
+
+//it reads the lines received from a connection
+class line_reader
+{
+	int fd;
+	string buffer;
+
+public:
+
+	line_reader(int f) : fd(f) {}
+
+	bool next(string& line)
+	{
+		size_t end;
+		while ((end = buffer.find('\n')) == string::npos)
+		{
+			char chunk[4096];
+			ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+			if (n <= 0)
+			{
+				if (buffer.empty()) return false;
+				line.swap(buffer);
+				buffer.clear();
+				return true;
+			}
+			buffer.append(chunk, n);
+		}
+		line = buffer.substr(0, end);
+		buffer.erase(0, end + 1);
+		return true;
+	}
+};
+
+static bool send_line(int fd, const string& line)
+{
+	string s = line + "\n";
+	for (size_t sent=0; sent<s.size(); )
+	{
+		ssize_t n = send(fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) return false;
+		sent += n;
+	}
+	return true;
+}
+
+static bool socket_address(const string& path, struct sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) return false;
+	strcpy(address.sun_path, path.c_str());
+	return true;
+}
+
+//biclusters are streamed to the client as in a partial result; the job is cancelled if the client disconnects
+class stream_handler : public ResultHandler
+{
+	int fd;
+	bool broken;
+	const intvect& kept_genes; //the loaded index of each gene, empty if they were not filtered
+
+public:
+
+	stream_handler(int f, const string& header, const intvect& k) : fd(f), broken(false), kept_genes(k)
+	{
+		broken = !send_line(fd, header);
+	}
+
+	void found(Bicluster& bicluster, unsigned long cell)
+	{
+		intvect genes = bicluster.getGeneCluster().getElements();
+		if (!kept_genes.empty())
+			for(unsigned int j=0; j<genes.size(); j++) genes[j] = kept_genes[genes[j]];
+		intvect conditions = bicluster.getConditionCluster().getElements();
+		ostringstream os;
+		os << "@ " << cell << endl;
+		for(unsigned int j=0; j<genes.size(); j++) os << genes[j] << "\t";
+		os << endl;
+		for(unsigned int j=0; j<conditions.size(); j++) os << conditions[j] << "\t";
+		if (!broken) broken = !send_line(fd, os.str());
+	}
+
+	bool cancelled()
+	{
+		return broken;
+	}
+};
+
+//a request is a command, a handle and key=value arguments
+static bool parse_request(const string& line, string& command, string& handle, map<string, string>& arguments)
+{
+	istringstream is(line);
+	string token;
+	if (!(is >> command)) return false;
+	is >> handle;
+	while (is >> token)
+	{
+		size_t eq = token.find('=');
+		if (eq == string::npos || eq == 0) return false;
+		arguments[token.substr(0, eq)] = token.substr(eq + 1);
+	}
+	return true;
+}
+
+template <class T> static bool parse_argument(map<string, string>& arguments, const string& key, T& value)
+{
+	map<string, string>::iterator it = arguments.find(key);
+	if (it == arguments.end()) return true;
+	istringstream is(it->second);
+	arguments.erase(it);
+	return (is >> value) && is.eof();
+}
+
+static bool parse_thresholds(map<string, string>& arguments, const string& key, floatvect& thresholds)
+{
+	map<string, string>::iterator it = arguments.find(key);
+	if (it == arguments.end()) return true;
+	istringstream is(it->second);
+	arguments.erase(it);
+	string t;
+	while (getline(is, t, ','))
+	{
+		istringstream ts(t);
+		float value;
+		if (!(ts >> value) || !ts.eof()) return false;
+		thresholds.push_back(value);
+	}
+	return !thresholds.empty();
+}
+
+//indices and ranges of indices (e.g., 0-99,150)
+static bool parse_indices(map<string, string>& arguments, const string& key, intvect& indices)
+{
+	map<string, string>::iterator it = arguments.find(key);
+	if (it == arguments.end()) return true;
+	istringstream is(it->second);
+	arguments.erase(it);
+	string t;
+	while (getline(is, t, ','))
+	{
+		int first, last;
+		char dash;
+		istringstream ts(t);
+		if (!(ts >> first)) return false;
+		last = first;
+		if (!ts.eof() && !(ts >> dash >> last && dash == '-')) return false;
+		if (!ts.eof() || first < 0 || last < first) return false;
+		for (int i=first; i<=last; i++) indices.push_back(i);
+	}
+	return !indices.empty();
+}
+
+
+
+Server::Server(const string& s, unsigned int w) : socket_path(s), workers(max(w, 1u)), listen_fd(-1), stopping(false), submitted(0)
+{
+}
+
+
+bool Server::later(const Job* a, const Job* b)
+{
+	if (a->priority != b->priority) return a->priority < b->priority;
+	return a->order > b->order;
+}
+
+
+bool Server::run()
+{
+	struct sockaddr_un address;
+	if (!socket_address(socket_path, address)) return false;
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) return false;
+	unlink(socket_path.c_str());
+	if (bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listen_fd, 16) != 0)
+	{
+		close(listen_fd);
+		return false;
+	}
+
+	vector<thread> pool;
+	for (unsigned int w=0; w<workers; w++)
+		pool.push_back(thread(&Server::work, this));
+
+	while (true)
+	{
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+		{
+			unique_lock<mutex> guard(lock);
+			if (stopping) break;
+			continue;
+		}
+		thread(&Server::serve, this, fd).detach();
+	}
+
+	//queued jobs are run before workers exit
+	{
+		unique_lock<mutex> guard(lock);
+		stopping = true;
+	}
+	queue_changed.notify_all();
+	for (unsigned int w=0; w<workers; w++)
+		pool[w].join();
+
+	close(listen_fd);
+	unlink(socket_path.c_str());
+	return true;
+}
+
+
+void Server::work()
+{
+	//threads are split evenly among the workers
+	omp_set_num_threads(max(1, omp_get_num_procs()/(int) workers));
+
+	while (true)
+	{
+		Job* job;
+		{
+			unique_lock<mutex> guard(lock);
+			while (queue.empty() && !stopping)
+				queue_changed.wait(guard);
+			if (queue.empty()) return;
+			pop_heap(queue.begin(), queue.end(), later);
+			job = queue.back();
+			queue.pop_back();
+		}
+
+		stream_handler handler(job->fd, job->engine->partialHeader(job->config), job->engine->getKeptGenes());
+		Biclustervect results;
+		cellvect found_at;
+		job_status_t status = job_interrupted;
+		if (!handler.cancelled())
+		{
+			Trace::Scope scope("job", "server", "priority", job->priority);
+			status = job->engine->run(job->config, results, found_at, &handler, &job->stats);
+		}
+
+		{
+			unique_lock<mutex> guard(lock);
+			job->status = status;
+			job->found = results.size();
+			job->finished = true;
+		}
+		job_finished.notify_all();
+	}
+}
+
+
+void Server::serve(int fd)
+{
+	line_reader reader(fd);
+	string line;
+	while (reader.next(line))
+	{
+		string command, handle;
+		map<string, string> arguments;
+		if (line.empty()) continue;
+		if (!parse_request(line, command, handle, arguments))
+		{
+			send_line(fd, "error malformed request");
+			continue;
+		}
+
+		string response;
+		if (command == "load") response = load(handle, arguments);
+		else if (command == "run") response = submit(fd, handle, arguments);
+		else if (command == "unload")
+		{
+			unique_lock<mutex> guard(lock);
+			response = datasets.erase(handle) ? "ok" : "error unknown handle '" + handle + "'";
+		}
+		else if (command == "list")
+		{
+			unique_lock<mutex> guard(lock);
+			for (map<string, shared_ptr<Engine> >::iterator it = datasets.begin(); it != datasets.end(); it++)
+			{
+				ostringstream os;
+				os << it->first << "\t" << it->second->getGenesNumber() << "\t" << it->second->getConditionsNumber();
+				send_line(fd, os.str());
+			}
+			ostringstream os;
+			os << "ok " << datasets.size() << " data sets, " << queue.size() << " queued jobs";
+			response = os.str();
+		}
+		else if (command == "shutdown")
+		{
+			{
+				unique_lock<mutex> guard(lock);
+				stopping = true;
+			}
+			::shutdown(listen_fd, SHUT_RDWR); //it wakes up accept
+			response = "ok";
+		}
+		else response = "error unknown command '" + command + "'";
+
+		if (!send_line(fd, response)) break;
+	}
+	close(fd);
+}
+
+
+string Server::load(const string& handle, map<string, string>& arguments)
+{
+	string input_filename = arguments["input"];
+	string gene_driver_filename = arguments["gene_information"];
+	string condition_driver_filename = arguments["condition_information"];
+	string precision_name = arguments.count("precision") ? arguments["precision"] : "fp32";
+	string accumulation_name = arguments.count("accumulation") ? arguments["accumulation"] : "fp32";
+	bool out_of_core = arguments["out_of_core"] == "1";
+	bool sparse = arguments["sparse"] == "1";
+	bool gene_annotations = arguments["gene_annotations"] == "1";
+	bool condition_annotations = arguments["condition_annotations"] == "1";
+	bool gene_embeddings = arguments["gene_embeddings"] == "1";
+	bool condition_embeddings = arguments["condition_embeddings"] == "1";
+	string metric_name = arguments.count("metric") ? arguments["metric"] : "euclidean";
+	metric_t metric;
+	size_t driver_cache = (arguments.count("driver_cache") ? atol(arguments["driver_cache"].c_str()) : 256) << 20;
+	float ann_recall = arguments.count("ann_recall") ? atof(arguments["ann_recall"].c_str()) : 0.0;
+	bool ann_validate = arguments["ann_validate"] == "1";
+	float min_gene_variance = arguments.count("min_gene_variance") ? atof(arguments["min_gene_variance"].c_str()) : 0.0;
+	float gene_variance_quantile = arguments.count("gene_variance_quantile") ? atof(arguments["gene_variance_quantile"].c_str()) : 0.0;
+	float gene_expression_quantile = arguments.count("gene_expression_quantile") ? atof(arguments["gene_expression_quantile"].c_str()) : 0.0;
+	precision_t precision;
+	scalar_t accumulation;
+
+	if (handle.empty() || input_filename.empty()) return "error load requires a handle and input";
+	if (!Matrix::parsePrecision(precision_name, precision)) return "error unknown precision '" + precision_name + "'";
+	if (!Matrix::parseScalar(accumulation_name, accumulation)) return "error unknown accumulator '" + accumulation_name + "'";
+	if (!Driver::parseMetric(metric_name, metric)) return "error unknown metric '" + metric_name + "'";
+	if (ann_recall < 0.0 || ann_recall >= 1.0) return "error ann_recall must be in [0, 1)";
+	if (min_gene_variance < 0.0 || gene_variance_quantile < 0.0 || gene_variance_quantile >= 1.0 || gene_expression_quantile < 0.0 || gene_expression_quantile >= 1.0)
+		return "error min_gene_variance must be non-negative, and gene_variance_quantile and gene_expression_quantile in [0, 1)";
+	bool filter = min_gene_variance > 0.0 || gene_variance_quantile > 0.0 || gene_expression_quantile > 0.0;
+	if (filter && (sparse || out_of_core)) return "error sparse and out_of_core inputs cannot be filtered";
+
+	cout << "Loading " << handle << "..." << endl;
+	shared_ptr<Engine> engine(new Engine());
+	istringstream gene_sources(gene_driver_filename), condition_sources(condition_driver_filename);
+	string source;
+	while (getline(gene_sources, source, ','))
+		if (!engine->loadGeneSource(source, gene_annotations ? "annotations" : gene_embeddings ? "embeddings" : "distances", driver_cache, metric))
+			return "error no additional information provided in file '" + source + "', or its genes differ from those of the other sources";
+	while (getline(condition_sources, source, ','))
+		if (!engine->loadConditionSource(source, condition_annotations ? "annotations" : condition_embeddings ? "embeddings" : "distances", driver_cache, metric))
+			return "error no additional information provided in file '" + source + "', or its conditions differ from those of the other sources";
+	floatvect weights, missing;
+	if (!Engine::parseFusion(arguments["gene_weights"], arguments["gene_missing"], engine->getGeneSourcesNumber(), weights, missing) || !engine->weighGeneSources(weights, missing) ||
+	    !Engine::parseFusion(arguments["condition_weights"], arguments["condition_missing"], engine->getConditionSourcesNumber(), weights, missing) || !engine->weighConditionSources(weights, missing))
+		return "error weights and missing distances must list at most one non-negative value (or skip) for each source";
+	if (sparse ? !engine->loadSparseData(input_filename) : !engine->loadData(input_filename, out_of_core))
+		return "error I cannot open the file '" + input_filename + "'";
+	if (filter && !engine->filterGenes(min_gene_variance, gene_variance_quantile, gene_expression_quantile)) return "error no gene passes the filter";
+	engine->prepare(precision, false, accumulation);
+	if (ann_recall > 0.0) engine->indexDrivers(ann_recall, ann_validate);
+	cout << "\t done." << endl;
+
+	unique_lock<mutex> guard(lock);
+	datasets[handle] = engine;
+	ostringstream os;
+	os << "ok " << engine->getGenesNumber() << " genes, " << engine->getConditionsNumber() << " conditions";
+	if (filter) os << " (" << engine->getLoadedGenesNumber() - engine->getGenesNumber() << " genes filtered)";
+	return os.str();
+}
+
+
+string Server::submit(int fd, const string& handle, map<string, string>& arguments)
+{
+	Job job;
+	job.priority = 0;
+	job.fd = fd;
+	job.finished = false;
+	job.found = 0;
+	{
+		unique_lock<mutex> guard(lock);
+		map<string, shared_ptr<Engine> >::iterator it = datasets.find(handle);
+		if (it == datasets.end()) return "error unknown handle '" + handle + "'";
+		job.engine = it->second;
+	}
+
+	JobConfig& config = job.config;
+	string shard_name;
+	bool ok = parse_argument(arguments, "runs", config.runs_number) && parse_argument(arguments, "seed", config.seed) &&
+	          parse_argument(arguments, "d_reduction", config.delta_reduce) && parse_argument(arguments, "d_expansion", config.delta_expand) &&
+	          parse_argument(arguments, "gene_ida", config.if_row_driver) && parse_argument(arguments, "condition_ida", config.if_col_driver) &&
+	          parse_thresholds(arguments, "gene_thresholds", config.gene_thresholds) && parse_thresholds(arguments, "condition_thresholds", config.condition_thresholds) &&
+	          parse_argument(arguments, "batch", config.batch_size) && parse_argument(arguments, "shard", shard_name) &&
+	          parse_argument(arguments, "saturation", config.saturation) && parse_argument(arguments, "time_budget", config.time_budget) &&
+	          parse_indices(arguments, "genes", config.gene_subset) && parse_indices(arguments, "conditions", config.condition_subset) &&
+	          parse_argument(arguments, "priority", job.priority);
+	if (!ok) return "error invalid argument";
+	if (!arguments.empty()) return "error unknown argument '" + arguments.begin()->first + "'";
+	if (!shard_name.empty() && (sscanf(shard_name.c_str(), "%u/%u", &config.shard, &config.shards) != 2 || config.shards == 0 || config.shard >= config.shards))
+		return "error shard must be i/N, with i < N";
+	if (config.saturation < 0.0 || (config.saturation > 0.0 && config.shards > 1))
+		return "error saturation must be non-negative, and it cannot be combined with shard";
+	if (config.time_budget < 0.0)
+		return "error time_budget must be non-negative";
+	if (config.gene_thresholds.empty() != config.condition_thresholds.empty())
+		return "error both gene_thresholds and condition_thresholds must be given";
+
+	//genes are given by their loaded index, and only those kept by the filter are viewed
+	const intvect& kept = job.engine->getKeptGenes();
+	if (!kept.empty() && !config.gene_subset.empty())
+	{
+		intvect subset;
+		for (unsigned int i=0; i<config.gene_subset.size(); i++)
+		{
+			intvect::const_iterator it = lower_bound(kept.begin(), kept.end(), config.gene_subset[i]);
+			if (it != kept.end() && *it == config.gene_subset[i]) subset.push_back(it - kept.begin());
+		}
+		if (subset.empty()) return "error no gene of the subset passes the filter";
+		config.gene_subset.swap(subset);
+	}
+
+	//the connection waits for the job, while results are streamed by the worker
+	{
+		unique_lock<mutex> guard(lock);
+		if (stopping) return "error the server is shutting down";
+		job.order = submitted++;
+		queue.push_back(&job);
+		push_heap(queue.begin(), queue.end(), later);
+	}
+	queue_changed.notify_one();
+	{
+		unique_lock<mutex> guard(lock);
+		while (!job.finished)
+			job_finished.wait(guard);
+	}
+
+	if (job.status == job_invalid) return "error the job requires additional information that was not loaded, or its subsets are not valid";
+	if (job.status == job_interrupted) return "error the job was cancelled";
+	if (job.status == job_failed) return "error the rows of the out-of-core data set cannot be mapped";
+	ostringstream os;
+	os << "ok " << job.found << " biclusters";
+	if (config.saturation > 0.0) os << " in " << job.stats.runs << " runs";
+	if (job.stats.expired) os << " (time budget elapsed after " << job.stats.cells << " cells)";
+	return os.str();
+}
+
+
+bool Server::request(const string& socket_path, istream& requests, ostream& output, ostream& log)
+{
+	struct sockaddr_un address;
+	if (!socket_address(socket_path, address)) return false;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return false;
+	if (connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	line_reader reader(fd);
+	string line;
+	bool ok = true;
+	while (getline(requests, line))
+	{
+		if (line.empty() || line[0] == '#') continue;
+		if (!send_line(fd, line))
+		{
+			ok = false;
+			break;
+		}
+
+		string response;
+		bool closed = true;
+		while (reader.next(response))
+		{
+			if (response.compare(0, 2, "ok") == 0 || response.compare(0, 5, "error") == 0)
+			{
+				log << response << endl;
+				if (response[0] == 'e') ok = false;
+				closed = false;
+				break;
+			}
+			output << response << endl;
+		}
+		if (closed)
+		{
+			ok = false;
+			break;
+		}
+	}
+	close(fd);
+	return ok;
+}
@@ -0,0 +1,122 @@
+//      Server.hpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "Engine.hpp"
+
+using namespace std;
+
+
+
+/**
+	\brief Server class.
+
+	A resident process keeping data sets loaded and prepared under named handles, and running jobs on
+	them on behalf of local clients. Clients connect to a Unix domain socket and send one request per line:
+
+	- load HANDLE input=FILE [gene_information=SOURCE,SOURCE,...] [condition_information=SOURCE,SOURCE,...] [gene_annotations=0] [condition_annotations=0]
+	       [gene_weights=W,W,...] [condition_weights=W,W,...] [gene_missing=D|skip,...] [condition_missing=D|skip,...] [driver_cache=256]
+	       [gene_embeddings=0] [condition_embeddings=0] [metric=euclidean] [ann_recall=0] [ann_validate=0] [precision=fp32] [accumulation=fp32] [out_of_core=0] [sparse=0]
+	       [min_gene_variance=0] [gene_variance_quantile=0] [gene_expression_quantile=0]
+	- run HANDLE [runs=10] [seed=0] [d_reduction=2.0] [d_expansion=0.5] [gene_ida=0] [condition_ida=0]
+	      [gene_thresholds=T,T,...] [condition_thresholds=T,T,...] [batch=1] [shard=0/1] [saturation=0] [time_budget=0]
+	      [genes=I,I-J,...] [conditions=I,I-J,...] [priority=0]
+	- unload HANDLE
+	- list
+	- shutdown
+
+	Each response ends with a line starting with "ok" or "error". The response to run is a partial result
+	(the same lines of a sharded run, \see the merge subcommand), streamed as biclusters are found. A run 
+	can be restricted to the genes and conditions of given indices (or ranges of them), which are viewed in 
+	place; its biclusters still refer to the whole data set. Genes dropped when loading (\see Engine::filterGenes) 
+	are never viewed, but the indices of genes in requests and responses are still those of the input.
+
+	Jobs are queued and run by a pool of workers, higher priority first, in submission order otherwise.
+	The threads are split evenly among the workers. A job whose client disconnects is cancelled.
+
+ */
+
+class Server {
+
+private:
+
+	struct Job;
+
+	string socket_path;
+	unsigned int workers;
+	int listen_fd;
+	bool stopping;
+
+	map<string, shared_ptr<Engine> > datasets;
+	vector<Job*> queue; //heap, by priority and submission order
+	unsigned long submitted;
+	mutex lock;
+	condition_variable queue_changed;
+	condition_variable job_finished;
+
+	static bool later(const Job* a, const Job* b);
+	void work();
+	void serve(int fd);
+	string load(const string& handle, map<string, string>& arguments);
+	string submit(int fd, const string& handle, map<string, string>& arguments);
+
+public:
+
+/**
+	\brief Return a server
+
+	\param socket_path filepath of the socket
+	\param workers number of jobs run at the same time
+	\return the server
+*/
+	Server(const string& socket_path, unsigned int workers);
+
+/**
+	\brief Serve clients until a shutdown request
+
+	\return false if the socket cannot be opened, true otherwise
+*/
+	bool run();
+
+/**
+	\brief Send requests to a server, one per line, and write the responses.
+
+	Partial results are written to output, while the closing line of each response is written to log.
+
+	\param socket_path filepath of the socket
+	\param requests the requests
+	\param output receiver of the results
+	\param log receiver of the responses status
+	\return false if the server cannot be reached or a request failed, true otherwise
+*/
+	static bool request(const string& socket_path, istream& requests, ostream& output, ostream& log);
+
+} ;
+
+#endif
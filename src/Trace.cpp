@@ -0,0 +1,182 @@
+//      Trace.cpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+
+struct trace_event
+{
+	const char* name;
+	const char* category;
+	const char* argument_name;
+	long argument;
+	double start;
+	double end;
+	unsigned long id; //seed trajectories only
+	bool seed;
+};
+
+//ring buffer of a thread
+struct trace_buffer
+{
+	vector<trace_event> events;
+	unsigned long recorded; //including the overwritten ones
+	unsigned int thread;
+};
+
+bool Trace::on = false;
+
+static unsigned int capacity = 1;
+static chrono::steady_clock::time_point origin;
+
+//buffers are registered once per thread, and read only when no thread is recording
+static mutex registration;
+static vector<trace_buffer*> buffers;
+static thread_local trace_buffer* local = NULL;
+
+
+static trace_event& next_event()
+{
+	if (local == NULL)
+	{
+		local = new trace_buffer;
+		local->events.resize(capacity);
+		local->recorded = 0;
+		lock_guard<mutex> guard(registration);
+		local->thread = buffers.size() + 1;
+		buffers.push_back(local);
+	}
+	return local->events[local->recorded++ % capacity];
+}
+
+
+void Trace::enable(unsigned int events)
+{
+	capacity = max(events, 1u);
+	origin = chrono::steady_clock::now();
+	on = true;
+}
+
+
+double Trace::now()
+{
+	return chrono::duration<double, micro>(chrono::steady_clock::now() - origin).count();
+}
+
+
+void Trace::record(const char* name, const char* category, double start, const char* argument_name, long argument)
+{
+	trace_event& e = next_event();
+	e.name = name;
+	e.category = category;
+	e.argument_name = argument_name;
+	e.argument = argument;
+	e.start = start;
+	e.end = now();
+	e.seed = false;
+}
+
+
+void Trace::seed(unsigned long id, double start, double end, int iterations, bool diverged)
+{
+	trace_event& e = next_event();
+	e.name = diverged ? "diverged seed" : "seed";
+	e.category = "seed";
+	e.argument_name = "iterations";
+	e.argument = iterations;
+	e.start = start;
+	e.end = end;
+	e.id = id;
+	e.seed = true;
+}
+
+
+//common fields of a JSON event
+static void put_header(ostream& os, const trace_event& e, const char* phase, unsigned int thread, double ts)
+{
+	os << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"" << phase << "\",\"pid\":1,\"tid\":" << thread << ",\"ts\":" << ts;
+}
+
+
+bool Trace::write(const string& filename)
+{
+	ofstream os(filename.c_str());
+	if (!os) return false;
+	os.setf(ios::fixed);
+	os.precision(3);
+
+	lock_guard<mutex> guard(registration);
+	os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+	bool first = true;
+	for (unsigned int b=0; b<buffers.size(); b++)
+	{
+		const trace_buffer& buffer = *buffers[b];
+		os << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.thread
+		   << ",\"args\":{\"name\":\"thread " << buffer.thread << "\"}}";
+		first = false;
+
+		//oldest events first
+		unsigned long kept = min(buffer.recorded, (unsigned long) capacity);
+		for (unsigned long k=buffer.recorded - kept; k<buffer.recorded; k++)
+		{
+			const trace_event& e = buffer.events[k % capacity];
+			os << ",\n";
+			if (e.seed)
+			{
+				//seeds of a batch overlap, so that they are async events, one track for each seed
+				put_header(os, e, "b", buffer.thread, e.start);
+				os << ",\"id\":\"" << buffer.thread << "." << e.id << "\",\"args\":{\"" << e.argument_name << "\":" << e.argument << "}},\n";
+				put_header(os, e, "e", buffer.thread, e.end);
+				os << ",\"id\":\"" << buffer.thread << "." << e.id << "\"}";
+			}
+			else
+			{
+				put_header(os, e, "X", buffer.thread, e.start);
+				os << ",\"dur\":" << e.end - e.start;
+				if (e.argument_name != NULL) os << ",\"args\":{\"" << e.argument_name << "\":" << e.argument << "}";
+				os << "}";
+			}
+		}
+	}
+	os << endl << "]}" << endl;
+	return (bool) os;
+}
+
+
+string Trace::to_string()
+{
+	lock_guard<mutex> guard(registration);
+	unsigned long recorded = 0, dropped = 0;
+	for (unsigned int b=0; b<buffers.size(); b++)
+	{
+		recorded += buffers[b]->recorded;
+		if (buffers[b]->recorded > capacity) dropped += buffers[b]->recorded - capacity;
+	}
+	ostringstream output;
+	output << recorded << " events on " << buffers.size() << " threads (" << dropped << " overwritten)";
+	return output.str();
+}
@@ -0,0 +1,163 @@
+//      Trace.hpp
+//
+//      Copyright 2013 Alessia Visconti <visconti@di.unito.it>
+//
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 3 of the License, or
+//      (at your option) any later version.
+//
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+//
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+//      MA 02110-1301, USA.
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+using namespace std;
+
+
+
+/**
+	\brief Trace class.
+
+	An opt-in timeline of the run: scoped events (phases, iterations, product kernels on each thread) and
+	seed trajectories, saved as a Chrome trace that opens in Perfetto or chrome://tracing.
+
+	Each thread records into its own ring buffer, registered the first time it records, so that recording takes
+	no lock; once a buffer is full, its oldest events are overwritten. Event names are string literals, which are
+	not copied. When tracing is not enabled, a scope costs a test of a flag.
+
+ */
+
+class Trace {
+
+private:
+
+	static bool on;
+
+public:
+
+/**
+	\brief Scoped event: it starts when constructed and ends when destroyed.
+*/
+
+	class Scope {
+
+	private:
+
+		const char* name;
+		const char* category;
+		const char* argument_name;
+		long argument;
+		double start;
+		bool active;
+
+	public:
+
+/**
+	\brief Start an event
+
+	\param name event name (a string literal)
+	\param category event category (a string literal)
+	\param argument_name name of the argument, or NULL if the event has none
+	\param argument argument value
+*/
+
+		Scope(const char* name, const char* category, const char* argument_name = NULL, long argument = 0)
+		: name(name), category(category), argument_name(argument_name), argument(argument), start(0.0), active(Trace::on)
+		{
+			if (active) start = Trace::now();
+		}
+
+/**
+	\brief End the event.
+*/
+
+		~Scope()
+		{
+			if (active) Trace::record(name, category, start, argument_name, argument);
+		}
+
+	} ;
+
+/**
+	\brief Start recording.
+
+	\param events number of events kept by each thread
+*/
+
+	static void enable(unsigned int events);
+
+/**
+	\brief Return whether events are recorded
+
+	\return true if recording, false otherwise
+*/
+
+	static bool enabled() { return on; }
+
+/**
+	\brief Return the trace time
+
+	\return microseconds since recording started
+*/
+
+	static double now();
+
+/**
+	\brief Record an event of the calling thread, which ends now.
+
+	Kernels record their events this way rather than through a Scope, which would keep the compiler from 
+	optimising their loops.
+
+	\param name event name (a string literal)
+	\param category event category (a string literal)
+	\param start start time
+	\param argument_name name of the argument, or NULL
+	\param argument argument value
+*/
+
+	static void record(const char* name, const char* category, double start, const char* argument_name, long argument);
+
+/**
+	\brief Record the trajectory of a seed, which may overlap the ones of other seeds of the same thread.
+
+	\param id seed identifier (e.g., its grid cell)
+	\param start start time
+	\param end end time
+	\param iterations number of iterations
+	\param diverged set if the seed diverged
+*/
+
+	static void seed(unsigned long id, double start, double end, int iterations, bool diverged);
+
+/**
+	\brief Save the events recorded so far as a Chrome trace (JSON)
+
+	\param filename filepath of the trace
+	\return false if the file cannot be written, true otherwise
+*/
+
+	static bool write(const string& filename);
+
+/**
+	\brief Return a string reporting the number of events recorded and dropped
+
+	\return the string representing the counters
+*/
+
+	static string to_string();
+
+} ;
+
+#endif
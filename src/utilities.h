@@ -32,6 +32,7 @@
 #include <string.h>
 #include <vector>
 #include <map>
+#include <stdint.h>
 
 
 using namespace std;
@@ -72,6 +73,10 @@ static const float min_condition_threshold = 2.0; //the min condition threshold
 static const float max_condition_threshold = 2.0; //the max condition threshold
 static const float condition_threshold_step = 0.5; //the step for condition threshold computation
 
+// --- Kernels ---
+static const int transpose_tile = 32; //side of the square tiles visited by Matrix::traspose
+static const size_t out_of_core_block = 64 << 20; //bytes of an out-of-core matrix mapped at once
+
 
 
 //==================
@@ -87,7 +92,7 @@ static const float condition_threshold_step = 0.5; //the step for condition thre
 */
 
 
-	static float vect_mean(floatvect v)
+	static float vect_mean(const floatvect& v)
 	{
 		return accumulate(v.begin(), v.end(), 0.0)/v.size();
 	}
@@ -100,7 +105,7 @@ static const float condition_threshold_step = 0.5; //the step for condition thre
 */
 
 
-	static float vect_variance(floatvect v)
+	static float vect_variance(const floatvect& v)
 	{
 		float mean = vect_mean(v);
 		float sum = 0.0;
@@ -117,22 +122,85 @@ static const float condition_threshold_step = 0.5; //the step for condition thre
 	\return the standard deviation
 */
 
-	static float vect_std(floatvect v)
+	static float vect_std(const floatvect& v)
 	{
 			return sqrt(vect_variance(v));
 	}
 
 /**
-	\brief Return a random value included in [0, max]
+	\brief Running mean and variance of a stream of values, according to [Welford, Technometrics, 1962].
+	
+	Two summaries can be merged [Chan et al., 1979], so that disjoint chunks of data can be summarised independently.
+*/
+
+	struct running_stats
+	{
+		double n;
+		double mean;
+		double m2;
+		
+		running_stats() : n(0.0), mean(0.0), m2(0.0) {}
+		
+		void push(double x)
+		{
+			n += 1.0;
+			double delta = x - mean;
+			mean += delta/n;
+			m2 += delta*(x - mean);
+		}
+		
+		void merge(const running_stats& o)
+		{
+			if (o.n == 0.0) return;
+			double tot = n + o.n;
+			double delta = o.mean - mean;
+			mean += delta*o.n/tot;
+			m2 += o.m2 + delta*delta*n*o.n/tot;
+			n = tot;
+		}
+		
+		//sample variance, as in vect_variance
+		double variance() const
+		{
+			return m2/(n - 1.0);
+		}
+	};
+
+/**
+	\brief Pseudo-random generator (splitmix64), whose whole state is a single integer.
+	
+	A generator is identified by a seed and a stream index: each stream can be generated 
+	without generating the ones before it (e.g., the seed of a run does not depend on previous runs).
+*/
+
+	struct random_generator
+	{
+		uint64_t state;
+		
+		random_generator(uint64_t seed, uint64_t stream) : state(seed)
+		{
+			state = next() ^ (stream*0xd1b54a32d192ed03ULL);
+		}
+		
+		uint64_t next()
+		{
+			uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+			return z ^ (z >> 31);
+		}
+
+/**
+	\brief Return a random value included in [0, max)
 	 
 	\param max_value the max value
 	\return a random value
 */
-	static int random_value(int max_value)
-	{
-		srand (time(NULL));
-		return rand()%max_value;
-	}
+		int value(int max_value)
+		{
+			return next()%max_value;
+		}
+	};
 	
 
 /**